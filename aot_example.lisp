@@ -0,0 +1,4 @@
+(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))
+(define tak (lambda (x y z) (if (not (< y x)) z
+  (tak (tak (- x 1) y z) (tak (- y 1) z x) (tak (- z 1) x y)))))
+(define fact (lambda (x) (if (< x 2) x (* x (fact (- x 1))))))
@@ -0,0 +1,1160 @@
+#include "lisp.h"
+#include "macro.h"
+#include "persistent.h"
+#include "reader.h"
+#include "serial.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// every allocation of the process is counted, so workloads can report live bytes and malloc calls
+namespace
+{
+    std::size_t liveBytes = 0;
+    std::size_t allocCalls = 0;
+    std::size_t peakBytes = 0;
+
+    // kept just below each block: its size and the start of the malloc'd region
+    struct Header{
+        std::size_t size;
+        void *raw;
+    };
+
+    // not inlined, so the compiler never pairs a new expression with the free below
+    [[gnu::noinline]] void *allocate(std::size_t _n, std::size_t _align)
+    {
+        _align = std::max(_align, alignof(std::max_align_t));
+        auto raw = static_cast<char *>(std::malloc(_n + sizeof(Header) + _align));
+        if(!raw){
+            throw std::bad_alloc();
+        }
+
+        auto at = reinterpret_cast<std::uintptr_t>(raw + sizeof(Header));
+        auto p = reinterpret_cast<char *>((at + _align - 1) & ~(std::uintptr_t(_align) - 1));
+        Header h{_n, raw};
+        std::memcpy(p - sizeof(Header), &h, sizeof(Header));
+        liveBytes += _n;
+        allocCalls++;
+        peakBytes = std::max(peakBytes, liveBytes);
+        return p;
+    }
+
+    [[gnu::noinline]] void release(void *_p) noexcept
+    {
+        if(_p){
+            Header h;
+            std::memcpy(&h, static_cast<char *>(_p) - sizeof(Header), sizeof(Header));
+            liveBytes -= h.size;
+            std::free(h.raw);
+        }
+    }
+}
+
+// scalar, array and aligned forms all go through the same pair
+void *operator new(std::size_t _n) { return allocate(_n, 0); }
+void *operator new[](std::size_t _n) { return allocate(_n, 0); }
+void *operator new(std::size_t _n, std::align_val_t _a) { return allocate(_n, std::size_t(_a)); }
+void *operator new[](std::size_t _n, std::align_val_t _a) { return allocate(_n, std::size_t(_a)); }
+void operator delete(void *_p) noexcept { release(_p); }
+void operator delete[](void *_p) noexcept { release(_p); }
+void operator delete(void *_p, std::size_t) noexcept { release(_p); }
+void operator delete[](void *_p, std::size_t) noexcept { release(_p); }
+void operator delete(void *_p, std::align_val_t) noexcept { release(_p); }
+void operator delete[](void *_p, std::align_val_t) noexcept { release(_p); }
+void operator delete(void *_p, std::size_t, std::align_val_t) noexcept { release(_p); }
+void operator delete[](void *_p, std::size_t, std::align_val_t) noexcept { release(_p); }
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Options{
+        int reps = 10;
+        int warmup = 2;
+        std::string filter;
+        std::string out;
+    };
+
+    struct Result{
+        std::string name;
+        std::vector<double> samples; // ns per run
+        std::vector<std::pair<std::string, double>> extra;
+        bool ok = true;
+    };
+
+    struct Workload{
+        std::string name;
+        std::string setup; // evaluated once per run of the suite
+        std::string expr;  // the timed expression
+        lisp::Int expected;
+        std::size_t calls = 0; // procedure calls per run, when known
+        std::optional<lisp::Budget> budget = std::nullopt; // run under a meter when set
+    };
+
+    // (define <name> (list 1 ... n))
+    std::string defineList(const std::string &_name, int _n)
+    {
+        std::string src = "(define " + _name + " (list";
+        for(int i = 1; i <= _n; i++){
+            src += " " + std::to_string(i);
+        }
+
+        return src + "))";
+    }
+
+    const std::vector<Workload> workloads = {
+        {
+            "fib",
+            "(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))",
+            "(fib 20)",
+            6765,
+            21891
+        },
+        {
+            // same as fib, to show the cost of checking budgets
+            "fib-metered",
+            "(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))",
+            "(fib 20)",
+            6765,
+            21891,
+            lisp::Budget{100000000, 100000000, 10000, 0}
+        },
+        {
+            "tak",
+            "(define tak (lambda (x y z) (if (not (< y x)) z"
+            "  (tak (tak (- x 1) y z) (tak (- y 1) z x) (tak (- z 1) x y)))))",
+            "(tak 12 8 4)",
+            5
+        },
+        {
+            "ackermann",
+            "(define ack (lambda (m n) (cond ((= m 0) (+ n 1))"
+            "  ((= n 0) (ack (- m 1) 1))"
+            "  (ack (- m 1) (ack m (- n 1))))))",
+            "(ack 2 9)",
+            21
+        },
+        {
+            // lists are cons closures, so the solver carries their lengths
+            "nqueens",
+            "(define ok? (lambda (row dist placed k) (if (= k 0) true"
+            "  (let (q (car placed))"
+            "    (if (or (= q row) (or (= q (+ row dist)) (= q (- row dist)))) false"
+            "      (ok? row (+ dist 1) (cdr placed) (- k 1)))))))"
+            "(define try (lambda (row n placed k) (if (= row n) 0"
+            "  (+ (if (ok? row 1 placed k)"
+            "         (if (= (+ k 1) n) 1 (try 0 n (cons row placed) (+ k 1)))"
+            "         0)"
+            "     (try (+ row 1) n placed k)))))"
+            "(define queens (lambda (n) (try 0 n 0 0)))",
+            "(queens 6)",
+            4
+        },
+        {
+            "list-reverse",
+            "(define build (lambda (i acc) (if (= i 0) acc (build (- i 1) (cons i acc)))))"
+            "(define rev (lambda (l k acc) (if (= k 0) acc (rev (cdr l) (- k 1) (cons (car l) acc)))))"
+            "(define sum (lambda (l k s) (if (= k 0) s (sum (cdr l) (- k 1) (+ s (car l))))))",
+            "(sum (rev (build 500 0) 500 0) 500 0)",
+            125250
+        },
+        {
+            "list-native",
+            defineList("xs", 1000),
+            "(foldl + 0 (map (lambda (x) (* x 2)) (filter (lambda (x) (> x 500)) xs)))",
+            750500
+        },
+        {
+            "closures",
+            "(define make-adder (lambda (n) (lambda (x) (+ x n))))"
+            "(define compose (lambda (f g) (lambda (x) (f (g x)))))"
+            "(define loop (lambda (i acc) (if (= i 0) acc"
+            "  (loop (- i 1) ((compose (make-adder i) (make-adder 1)) acc)))))",
+            "(loop 1000 0)",
+            501500
+        },
+        {
+            "lets",
+            "(define lets (lambda (i acc) (if (= i 0) acc"
+            "  (let (a (+ i 1))"
+            "    (let (b (* a 2)) (c 1)"
+            "      (let (d (- b a))"
+            "        (lets (- i 1) (+ acc (+ d c)))))))))",
+            "(lets 1000 0)",
+            502500
+        },
+        {
+            // fixnums promote to bignums after (fact 20), then each step is a bignum by fixnum product
+            "fact-1000",
+            "(define fact (lambda (x) (if (< x 2) x (* x (fact (- x 1))))))",
+            "(mod (fact 1000) 1000000007)",
+            641419708,
+            1000
+        },
+        {
+            // a Karatsuba sized square and its decimal text
+            "bignum-text",
+            "(define fact (lambda (x) (if (< x 2) x (* x (fact (- x 1))))))"
+            "(define big (fact 2000))",
+            "(string-length (number->string (* big big)))",
+            11472
+        },
+        {
+            // changing one element copies the list up to it, cdr copies the rest as well
+            "list-update",
+            defineList("xs", 100) +
+            "(define set-nth (lambda (l i x) (if (= i 0) (cons x (cdr l))"
+            "  (cons (car l) (set-nth (cdr l) (- i 1) x)))))"
+            "(define bump (lambda (l i) (if (= i 100) l (bump (set-nth l i (* 2 (list-ref l i))) (+ i 1)))))",
+            "(foldl + 0 (bump xs 0))",
+            10100
+        },
+        {
+            // the same updates copy one path of the tree each
+            "vector-update",
+            defineList("xs", 100) +
+            "(define vs (list->vector xs))"
+            "(define bump (lambda (v i) (if (= i 100) v (bump (vector-set v i (* 2 (vector-ref v i))) (+ i 1)))))",
+            "(foldl + 0 (vector->list (bump vs 0)))",
+            10100
+        },
+        {
+            "alist-lookup",
+            defineList("xs", 500) +
+            "(define al (map (lambda (k) (list k (* k k))) xs))"
+            "(define look (lambda (i acc) (if (= i 0) acc (look (- i 1) (+ acc (car (cdr (assoc i al))))))))",
+            "(look 500 0)",
+            41791750
+        },
+        {
+            "map-lookup",
+            defineList("xs", 500) +
+            "(define hm (list->map (map (lambda (k) (list k (* k k))) xs)))"
+            "(define look (lambda (i acc) (if (= i 0) acc (look (- i 1) (+ acc (map-ref hm i))))))",
+            "(look 500 0)",
+            41791750
+        },
+        {
+            // a new version per element
+            "vector-push",
+            "(define build (lambda (v i) (if (= i 0) v (build (vector-push v i) (- i 1)))))",
+            "(vector-length (build (vector) 1000))",
+            1000
+        },
+        {
+            // one transient builder filled in place
+            "vector-transient",
+            defineList("xs", 1000),
+            "(vector-length (list->vector xs))",
+            1000
+        },
+        {
+            // when is expanded into an if once, at the definition of f
+            "macro-when",
+            "(define f (lambda (i acc) (if (= i 0) acc (f (- i 1) (+ acc (when (< 0 i) i))))))",
+            "(f 1000 0)",
+            500500
+        },
+        {
+            // the same conditional as a procedure, the body has to be passed as a thunk
+            "thunk-when",
+            "(define when* (lambda (c thunk) (if c (thunk) false)))"
+            "(define f (lambda (i acc) (if (= i 0) acc (f (- i 1) (+ acc (when* (< 0 i) (lambda () i)))))))",
+            "(f 1000 0)",
+            500500
+        },
+        {
+            // a recursive syntax-rules macro, with a binder renamed at each expansion
+            "syntax-rules",
+            "(define-syntax any (syntax-rules () ((_) false) ((_ e r ...) (let (t e) (if t t (any r ...))))))"
+            "(define f (lambda (i acc) (if (= i 0) acc (f (- i 1) (+ acc (if (any (= i 0) (< i 0) (> i 0)) i 0))))))",
+            "(f 1000 0)",
+            500500
+        },
+        {
+            "named-let",
+            "(define f (lambda (n) (let loop (i n) (acc 0) (if (= i 0) acc (loop (- i 1) (+ acc i))))))",
+            "(f 1000)",
+            500500
+        },
+        {
+            "let-star",
+            "(define f (lambda (i acc) (if (= i 0) acc"
+            "  (f (- i 1) (let* (a (+ i 1)) (b (* a 2)) (+ acc (- b a)))))))",
+            "(f 1000 0)",
+            501500
+        },
+#ifndef _WIN32
+        {
+            // calls count task switches: 1000 tasks yielding 100 times each
+            "green-switch",
+            "(define spin (lambda (n) (if (= n 0) 1 (begin (yield) (spin (- n 1))))))"
+            "(define start (lambda (i acc) (if (= i 0) acc"
+            "  (start (- i 1) (cons (spawn (lambda () (spin 100))) acc)))))"
+            "(define joinall (lambda (ts acc) (if (null? ts) acc (joinall (cdr ts) (+ acc (join (car ts)))))))",
+            "(joinall (start 1000 (list)) 0)",
+            1000,
+            101000
+        },
+        {
+            // calls count messages through a small channel between two tasks,
+            // task stacks are small, so both loop over streams instead of recursing
+            "green-channel",
+            "(define ints (lambda (n) (stream-cons n (ints (+ n 1)))))"
+            "(define produce (lambda (c n) (begin"
+            "  (stream-fold (lambda (i acc) (send c i)) true (stream-take n (ints 1))) (send c 0))))"
+            "(define consume (lambda (c n) (stream-fold (lambda (i acc) (+ acc (recv c))) 0 (stream-take n (ints 1)))))"
+            "(define pipe (lambda (n) (let (c (chan 64))"
+            "  (begin (spawn (lambda () (produce c n))) (join (spawn (lambda () (consume c n))))))))",
+            "(pipe 20000)",
+            200010000,
+            20001
+        },
+#endif
+#ifdef LISP_NATIVE_EXAMPLE
+        {
+            // calls count primitive calls, against native-builtin below to show the plugin costs nothing extra
+            "native-plugin",
+            "(load-native \"" LISP_NATIVE_EXAMPLE "\")"
+            "(define sq (lambda (i acc) (if (= i 0) acc (sq (- i 1) (+ acc (square 3))))))",
+            "(sq 5000 0)",
+            45000,
+            5000
+        },
+        {
+            "native-builtin",
+            "(define mul (lambda (i acc) (if (= i 0) acc (mul (- i 1) (+ acc (* 3 3))))))",
+            "(mul 5000 0)",
+            45000,
+            5000
+        },
+#endif
+#ifdef LISP_AOT_EXAMPLE
+        // aot_example.lisp compiled by lisp2cpp, against fib, tak and fact-1000 above
+        {
+            "fib-aot",
+            "(load-native \"" LISP_AOT_EXAMPLE "\")",
+            "(fib 20)",
+            6765,
+            21891
+        },
+        {
+            "tak-aot",
+            "(load-native \"" LISP_AOT_EXAMPLE "\")",
+            "(tak 12 8 4)",
+            5
+        },
+        {
+            // fixnums overflow after (fact 20), the call is redone by the generic version with bignums
+            "fact-aot",
+            "(load-native \"" LISP_AOT_EXAMPLE "\")",
+            "(mod (fact 1000) 1000000007)",
+            641419708,
+            1000
+        },
+#endif
+#ifndef _WIN32
+        // calls count inputs, 16 of (fib 18) spread over 1, 2 and 4 forked workers
+        {
+            "shard-map-w1",
+            "(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))"
+            "(define jobs (list 18 18 18 18 18 18 18 18 18 18 18 18 18 18 18 18))",
+            "(foldl + 0 (shard-map fib jobs :workers 1))",
+            41344,
+            16
+        },
+        {
+            "shard-map-w2",
+            "(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))"
+            "(define jobs (list 18 18 18 18 18 18 18 18 18 18 18 18 18 18 18 18))",
+            "(foldl + 0 (shard-map fib jobs :workers 2))",
+            41344,
+            16
+        },
+        {
+            "shard-map-w4",
+            "(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))"
+            "(define jobs (list 18 18 18 18 18 18 18 18 18 18 18 18 18 18 18 18))",
+            "(foldl + 0 (shard-map fib jobs :workers 4))",
+            41344,
+            16
+        },
+#endif
+    };
+
+    bool selected(const Options &_opts, const std::string &_name)
+    {
+        return _opts.filter.empty() || _name.find(_opts.filter) != std::string::npos;
+    }
+
+    template<typename F>
+    bool measure(Result &_result, const Options &_opts, F _body)
+    {
+        for(int i = 0; i < _opts.warmup; i++){
+            if(!_body()){
+                return false;
+            }
+        }
+
+        for(int i = 0; i < _opts.reps; i++){
+            auto start = Clock::now();
+            bool ok = _body();
+            auto stop = Clock::now();
+
+            if(!ok){
+                return false;
+            }
+
+            _result.samples.push_back(
+                std::chrono::duration<double, std::nano>(stop - start).count()
+            );
+        }
+
+        return true;
+    }
+
+    struct Stats{
+        double median, mean, stddev, min, max;
+    };
+
+    Stats summarize(std::vector<double> _samples)
+    {
+        Stats stats{0, 0, 0, 0, 0};
+        if(_samples.empty()){
+            return stats;
+        }
+
+        std::sort(_samples.begin(), _samples.end());
+        auto n = _samples.size();
+        stats.median = n % 2 ? _samples[n / 2] : (_samples[n / 2 - 1] + _samples[n / 2]) / 2;
+        stats.min = _samples.front();
+        stats.max = _samples.back();
+
+        for(auto s : _samples){
+            stats.mean += s;
+        }
+        stats.mean /= n;
+
+        if(n > 1){
+            for(auto s : _samples){
+                stats.stddev += (s - stats.mean) * (s - stats.mean);
+            }
+            stats.stddev = std::sqrt(stats.stddev / (n - 1));
+        }
+
+        return stats;
+    }
+
+    bool evalAll(const std::string &_src, lisp::PtrEnvir &_envir)
+    {
+        std::istringstream sin(_src);
+
+        while(true){
+            auto form = lisp::parseInput(sin);
+            if(!form){
+                return true;
+            }
+
+            if(!lisp::expandAll(form.value(), _envir) || !lisp::evaluate(form.value(), _envir)){
+                return false;
+            }
+        }
+    }
+
+    Result runWorkload(const Workload &_work, const Options &_opts)
+    {
+        Result result;
+        result.name = _work.name;
+
+        auto envir = lisp::Environment::createEnvir();
+        auto expr = lisp::parseString(_work.expr);
+        if(!evalAll(_work.setup, envir) || !expr || !lisp::expandAll(expr.value(), envir)){
+            result.ok = false;
+            return result;
+        }
+
+        auto run = [&]()
+            {
+                auto value = _work.budget
+                    ? lisp::evaluate(expr.value(), envir, _work.budget.value())
+                    : lisp::evaluate(expr.value(), envir);
+                return value && value.value().isType<lisp::Int>()
+                    && value.value().get<lisp::Int>() == _work.expected;
+            };
+
+        result.ok = measure(result, _opts, run);
+
+        if(result.ok){
+            auto before = allocCalls;
+            run();
+            double allocs = allocCalls - before;
+
+            result.extra.push_back({"allocs_per_run", allocs});
+            if(_work.calls){
+                result.extra.push_back({"allocs_per_call", allocs / _work.calls});
+                result.extra.push_back({"calls_per_s", _work.calls / (summarize(result.samples).median / 1e9)});
+            }
+        }
+
+        return result;
+    }
+
+    std::string generateSource(std::size_t _bytes)
+    {
+        std::string src;
+        for(int i = 0; src.size() < _bytes; i++){
+            auto n = std::to_string(i);
+            src += "(define f" + n + " (lambda (x y) (if (< x y) (+ x " + n
+                 + ".5) (let (z (* y 2)) (cond ((= z 0) (- x)) (f" + n + " y z))))))\n";
+        }
+
+        return src;
+    }
+
+    Result runParser(const Options &_opts)
+    {
+        Result result;
+        result.name = "parser";
+
+        auto src = generateSource(1 << 20);
+        std::size_t forms = 0;
+
+        result.ok = measure(result, _opts, [&]()
+            {
+                std::istringstream sin(src);
+                forms = 0;
+
+                while(lisp::parseInput(sin)){
+                    forms++;
+                }
+
+                return forms > 0;
+            }
+        );
+
+        if(result.ok){
+            auto sorted = result.samples;
+            std::sort(sorted.begin(), sorted.end());
+            double seconds = sorted[sorted.size() / 2] / 1e9;
+            result.extra.push_back({"bytes", double(src.size())});
+            result.extra.push_back({"forms", double(forms)});
+            result.extra.push_back({"mb_per_s", src.size() / seconds / (1 << 20)});
+        }
+
+        return result;
+    }
+
+    // records pulled one at a time from a data file, peak memory past the reader buffer stays at one record
+    Result runReader(const Options &_opts)
+    {
+        Result result;
+        result.name = "reader";
+
+        auto path = (std::filesystem::temp_directory_path() / "lisp_bench_records.sexp").string();
+        const int records = 100000;
+        {
+            std::ofstream fout(path);
+            for(int i = 0; i < records; i++){
+                fout << "(record " << i << " " << i * 0.5 << " (tags alpha beta) (point " << i % 97 << " " << i % 89 << "))\n";
+            }
+        }
+        auto bytes = double(std::filesystem::file_size(path));
+
+        double peak = 0;
+        int count = 0;
+        result.ok = measure(result, _opts, [&]()
+            {
+                lisp::FormReader reader(path);
+                auto before = liveBytes;
+                peakBytes = liveBytes;
+                count = 0;
+
+                for(auto &form : reader){
+                    count += form.isType<lisp::List>();
+                }
+
+                peak = double(peakBytes - before);
+                return reader.good() && count == records;
+            }
+        );
+
+        std::filesystem::remove(path);
+
+        if(result.ok){
+            auto seconds = summarize(result.samples).median / 1e9;
+            result.extra.push_back({"records", double(records)});
+            result.extra.push_back({"records_per_s", records / seconds});
+            result.extra.push_back({"mb_per_s", bytes / seconds / (1 << 20)});
+            result.extra.push_back({"peak_bytes", peak});
+            result.ok = peak < bytes / 16;
+        }
+
+        return result;
+    }
+
+    // a line-oriented script: lines read lazily, parsed, summed and copied through a writer
+    Result runText(const Options &_opts)
+    {
+        Result result;
+        result.name = "text-lines";
+
+        auto dir = std::filesystem::temp_directory_path();
+        auto in = (dir / "lisp_bench_lines.txt").string();
+        auto out = (dir / "lisp_bench_lines.out").string();
+        const int lines = 50000;
+        long sum = 0;
+        {
+            std::ofstream fout(in);
+            for(int i = 0; i < lines; i++){
+                fout << "key" << i % 10 << "," << i % 1000 << "\n";
+                sum += i % 1000;
+            }
+        }
+        auto bytes = double(std::filesystem::file_size(in));
+
+        auto envir = lisp::Environment::createEnvir();
+        auto expr = lisp::parseString(
+            "(let (w (open-writer \"" + out + "\"))"
+            "  (let (total (stream-fold"
+            "    (lambda (line acc) (begin (write-line w (substring line 0 4))"
+            "      (+ acc (string->number (substring line 5)))))"
+            "    0 (file-lines \"" + in + "\")))"
+            "    (begin (close-writer w) total)))"
+        );
+
+        result.ok = expr && measure(result, _opts, [&]()
+            {
+                auto value = lisp::evaluate(expr.value(), envir);
+                return value && value.value().isType<lisp::Int>() && value.value().get<lisp::Int>() == sum;
+            }
+        );
+
+        std::filesystem::remove(in);
+        std::filesystem::remove(out);
+
+        if(result.ok){
+            auto seconds = summarize(result.samples).median / 1e9;
+            result.extra.push_back({"lines_per_s", lines / seconds});
+            result.extra.push_back({"mb_per_s", bytes / seconds / (1 << 20)});
+        }
+
+        return result;
+    }
+
+    // a large nested result: records with nested lists, as maps for JSON and as (key value)
+    // entries for S-expressions, which have no text for maps
+    lisp::Cell generateRecords(int _n, bool _json)
+    {
+        lisp::List records;
+        for(int i = 0; i < _n; i++){
+            std::vector<std::pair<const char *, lisp::Cell>> fields = {
+                {"id", i},
+                {"name", lisp::String("user-" + std::to_string(i))},
+                {"score", double(i) / 7},
+                {"active", i % 3 == 0},
+                {"tags", lisp::List{lisp::String("alpha"), lisp::String("beta \"quoted\"")}},
+                {"pos", lisp::List{i % 97, lisp::List{i % 89, -i}}},
+            };
+
+            if(_json){
+                lisp::MapBuilder record;
+                for(auto &[key, value] : fields){
+                    record.set(lisp::Quotation(key), std::move(value));
+                }
+                records.push_back(record.build());
+            }
+            else{
+                lisp::List record;
+                for(auto &[key, value] : fields){
+                    record.push_back(lisp::List{lisp::Quotation(key), std::move(value)});
+                }
+                records.push_back(std::move(record));
+            }
+        }
+        return records;
+    }
+
+    // one direction of a format over the records, checked to read back equal
+    Result runSerial(const Options &_opts, const std::string &_name, bool _json, bool _write)
+    {
+        Result result;
+        result.name = _name;
+
+        auto value = generateRecords(20000, _json);
+        std::string text;
+        result.ok = _json ? lisp::writeJson(value, text) : lisp::writeSexpr(value, text);
+
+        auto back = _json ? lisp::readJson(text) : lisp::readSexpr(text);
+        result.ok = result.ok && back && back.value() == value;
+
+        result.ok = result.ok && measure(result, _opts, [&]()
+            {
+                if(_write){
+                    std::string out;
+                    out.reserve(text.size());
+                    return _json ? lisp::writeJson(value, out) : lisp::writeSexpr(value, out);
+                }
+                return (_json ? lisp::readJson(text) : lisp::readSexpr(text)).has_value();
+            }
+        );
+
+        if(result.ok){
+            auto seconds = summarize(result.samples).median / 1e9;
+            result.extra.push_back({"bytes", double(text.size())});
+            result.extra.push_back({"mb_per_s", text.size() / seconds / (1 << 20)});
+        }
+
+        return result;
+    }
+
+#ifndef _WIN32
+    std::size_t residentBytes()
+    {
+        std::ifstream statm("/proc/self/statm");
+        std::size_t pages = 0, resident = 0;
+        statm >> pages >> resident;
+        return resident * sysconf(_SC_PAGESIZE);
+    }
+
+    // memory held per task while 10000 tasks are blocked on one channel, stacks included
+    Result runGreenMemory(const Options &_opts)
+    {
+        Result result;
+        result.name = "green-memory";
+
+        const int tasks = 10000;
+        auto envir = lisp::Environment::createEnvir();
+        result.ok = evalAll(
+            "(define c (chan))"
+            "(define ts (list))"
+            + defineList("xs", tasks),
+            envir
+        );
+
+        auto start = lisp::parseString("(set! ts (map (lambda (i) (spawn (lambda () (recv c)))) xs))");
+        auto block = lisp::parseString("(yield)");
+        auto finish = lisp::parseString("(begin (for-each (lambda (i) (send c i)) xs) (for-each join ts) (set! ts (list)))");
+
+        double heap = 0, resident = 0;
+        result.ok = result.ok && measure(result, _opts, [&]()
+            {
+                auto beforeHeap = liveBytes;
+                auto beforeResident = residentBytes();
+
+                bool ok = lisp::evaluate(start.value(), envir) && lisp::evaluate(block.value(), envir);
+                heap = double(liveBytes - beforeHeap) / tasks;
+                resident = double(residentBytes() - beforeResident) / tasks;
+
+                return ok && lisp::evaluate(finish.value(), envir);
+            }
+        );
+
+        result.extra.push_back({"tasks", double(tasks)});
+        result.extra.push_back({"heap_bytes_per_task", heap});
+        result.extra.push_back({"resident_bytes_per_task", resident});
+        return result;
+    }
+
+    // the first worker to call (crash-once x) exits, or to call (hang-once x) never returns
+    // until the timeout kills it, the map has to resubmit its input
+    Result runShardFault(const Options &_opts, bool _hang)
+    {
+        Result result;
+        result.name = _hang ? "shard-map-hang" : "shard-map-fault";
+
+        auto marker = (std::filesystem::temp_directory_path() / ("lisp_bench_" + result.name)).string();
+        std::string once = _hang ? "hang-once" : "crash-once";
+        lisp::Environment::globalEnvir.extend(once, lisp::wrap(
+            [marker, _hang](lisp::Args _args, lisp::PtrEnvir &) -> std::optional<lisp::Cell>
+            {
+                auto fd = open(marker.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0600);
+                if(fd >= 0){
+                    while(_hang){
+                        pause();
+                    }
+                    _exit(3);
+                }
+                return _args.front();
+            }
+        ));
+
+        auto envir = lisp::Environment::createEnvir();
+        result.ok = evalAll(
+            "(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))"
+            "(define jobs (list 15 15 15 15 15 15 15 15))",
+            envir
+        );
+
+        auto expr = lisp::parseString("(foldl + 0 (shard-map (lambda (n) (" + once + " (fib n))) jobs :workers 2 :timeout 500))");
+        result.ok = result.ok && measure(result, _opts, [&]()
+            {
+                std::filesystem::remove(marker);
+                auto value = lisp::evaluate(expr.value(), envir);
+                return value && value.value().isType<lisp::Int>() && value.value().get<lisp::Int>() == 8 * 610;
+            }
+        );
+
+        std::filesystem::remove(marker);
+        return result;
+    }
+
+#endif
+
+    // A form nested 200 deep evaluates without allocating once nothing on the way copies
+    // the form: any copy of a sublist shows up as allocations and fails the check.
+    Result runBorrow(const Options &_opts)
+    {
+        Result result;
+        result.name = "ast-borrow";
+
+        std::string src = "1";
+        for(int i = 0; i < 200; i++){
+            src = (i % 2 ? "(if true " : "(cond (false 0) ") + src + (i % 2 ? " 0)" : ")");
+        }
+
+        auto envir = lisp::Environment::createEnvir();
+        auto expr = lisp::parseString(src);
+        auto run = [&]()
+            {
+                auto value = lisp::evaluate(expr.value(), envir);
+                return value && value.value().isType<lisp::Int>() && value.value().get<lisp::Int>() == 1;
+            };
+
+        result.ok = expr && measure(result, _opts, run);
+
+        auto before = allocCalls;
+        result.ok = result.ok && run();
+        double allocs = allocCalls - before;
+
+        result.extra.push_back({"allocs_per_run", allocs});
+        result.ok = result.ok && allocs == 0;
+        return result;
+    }
+
+    // Runs out of each budget, and of the stack without one, then evaluates again:
+    // a failed evaluation must leave no meter behind and the interpreter usable.
+    Result runRecovery(const Options &_opts)
+    {
+        Result result;
+        result.name = "budget-recovery";
+
+        auto envir = lisp::Environment::createEnvir();
+        result.ok = evalAll(
+            "(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))"
+            "(define deep (lambda (n) (if (= n 0) 0 (+ 1 (deep (- n 1))))))",
+            envir
+        );
+
+        auto heavy = lisp::parseString("(fib 20)");
+        auto light = lisp::parseString("(fib 15)");
+        auto unbounded = lisp::parseString("(deep 100000000)");
+        const std::vector<lisp::Budget> limits = {
+            {1000, 0, 0, 0},
+            {0, 1000, 0, 0},
+            {0, 0, 10, 0},
+            {0, 0, 0, 1000}
+        };
+
+        // the failures are expected, their messages are not part of the output
+        std::ostringstream muted;
+        auto saved = std::cerr.rdbuf(muted.rdbuf());
+
+        double hit = 0;
+        auto recovers = [&](std::optional<lisp::Cell> _failed)
+            {
+                if(_failed || lisp::Meter::active()){
+                    return false;
+                }
+
+                hit++;
+                auto value = lisp::evaluate(light.value(), envir);
+                return value && value.value().isType<lisp::Int>() && value.value().get<lisp::Int>() == 610;
+            };
+
+        result.ok = result.ok && measure(result, _opts, [&]()
+            {
+                hit = 0;
+                for(auto &limit : limits){
+                    if(!recovers(lisp::evaluate(heavy.value(), envir, limit))){
+                        return false;
+                    }
+                }
+
+                return recovers(lisp::evaluate(unbounded.value(), envir));
+            }
+        );
+
+        std::cerr.rdbuf(saved);
+        result.extra.push_back({"limits_hit", hit});
+        return result;
+    }
+
+    // small closures returned from lets whose frames hold a large temporary list
+    Result runRetention(const Options &_opts)
+    {
+        Result result;
+        result.name = "closure-retain";
+
+        auto envir = lisp::Environment::createEnvir();
+        result.ok = evalAll(
+            "(define build (lambda (i acc) (if (= i 0) acc (build (- i 1) (cons i acc)))))"
+            "(define make (lambda (n) (let (data (build 50 0)) (scale (* n 2))"
+            "  (let (total (+ n 1)) (lambda (x) (+ x scale))))))"
+            "(define keep (lambda (i acc) (if (= i 0) acc (keep (- i 1) (cons (make i) acc)))))",
+            envir
+        );
+
+        const int closures = 200;
+        auto expr = lisp::parseString("(keep " + std::to_string(closures) + " 0)");
+
+        auto retained = [&]() -> double
+            {
+                auto before = liveBytes;
+                auto value = lisp::evaluate(expr.value(), envir);
+                result.ok = result.ok && value;
+                return double(liveBytes - before);
+            };
+
+        lisp::Procedure::flatCapture = false;
+        auto full = retained();
+        lisp::Procedure::flatCapture = true;
+        auto flat = retained();
+
+        result.ok = result.ok && measure(result, _opts, [&]()
+            {
+                return lisp::evaluate(expr.value(), envir).has_value();
+            }
+        );
+
+        result.extra.push_back({"retained_bytes_full", full});
+        result.extra.push_back({"retained_bytes_flat", flat});
+        result.extra.push_back({"bytes_per_closure_full", full / closures});
+        result.extra.push_back({"bytes_per_closure_flat", flat / closures});
+        return result;
+    }
+
+    // a lazy pipeline folded to a single value: peak memory stays flat as the element count grows
+    Result runStream(const Options &_opts)
+    {
+        Result result;
+        result.name = "stream-pipeline";
+
+        auto envir = lisp::Environment::createEnvir();
+        result.ok = evalAll(
+            "(define ints (lambda (n) (stream-cons n (ints (+ n 1)))))"
+            "(define pipeline (lambda (n) (stream-fold + 0"
+            "  (stream-take n (stream-filter (lambda (x) (= (mod x 2) 0))"
+            "    (stream-map (lambda (x) (* x 3)) (ints 1)))))))",
+            envir
+        );
+
+        auto peak = [&](int _n) -> double
+            {
+                auto expr = lisp::parseString("(pipeline " + std::to_string(_n) + ")");
+                auto before = liveBytes;
+                peakBytes = liveBytes;
+
+                auto value = lisp::evaluate(expr.value(), envir);
+                result.ok = result.ok && value && value.value().isType<lisp::Int>()
+                    && value.value().get<lisp::Int>() == 3 * _n * (_n + 1);
+                return double(peakBytes - before);
+            };
+
+        auto small = peak(1000);
+        auto large = peak(20000);
+
+        auto expr = lisp::parseString("(pipeline 5000)");
+        result.ok = result.ok && measure(result, _opts, [&]()
+            {
+                return lisp::evaluate(expr.value(), envir).has_value();
+            }
+        );
+
+        result.extra.push_back({"peak_bytes_1000", small});
+        result.extra.push_back({"peak_bytes_20000", large});
+        result.ok = result.ok && large < 2 * small;
+        return result;
+    }
+
+    std::string jsonString(const std::string &_s)
+    {
+        std::string out = "\"";
+        for(char c : _s){
+            if(c == '"' || c == '\\'){
+                out.push_back('\\');
+            }
+            out.push_back(c);
+        }
+        out.push_back('"');
+        return out;
+    }
+
+    void writeJson(std::ostream &_out, const std::vector<Result> &_results, const Options &_opts)
+    {
+        _out.precision(12);
+        _out << "{\n  \"suite\": \"lisp_bench\",\n"
+             << "  \"unit\": \"ns\",\n"
+             << "  \"warmup\": " << _opts.warmup << ",\n"
+             << "  \"reps\": " << _opts.reps << ",\n"
+             << "  \"results\": [";
+
+        for(std::size_t i = 0; i < _results.size(); i++){
+            auto &r = _results[i];
+            auto stats = summarize(r.samples);
+
+            _out << (i ? "," : "") << "\n    {\"name\": " << jsonString(r.name)
+                 << ", \"ok\": " << (r.ok ? "true" : "false")
+                 << ", \"median\": " << stats.median
+                 << ", \"mean\": " << stats.mean
+                 << ", \"stddev\": " << stats.stddev
+                 << ", \"min\": " << stats.min
+                 << ", \"max\": " << stats.max
+                 << ", \"samples\": " << r.samples.size();
+
+            for(auto &[key, value] : r.extra){
+                _out << ", " << jsonString(key) << ": " << value;
+            }
+
+            _out << "}";
+        }
+
+        _out << "\n  ]\n}\n";
+    }
+
+    bool parseOptions(int argc, char *argv[], Options &_opts)
+    {
+        for(int i = 1; i < argc; i++){
+            std::string arg = argv[i];
+
+            if(i + 1 >= argc){
+                return false;
+            }
+
+            std::string value = argv[++i];
+            if(arg == "--reps"){
+                _opts.reps = std::max(1, std::atoi(value.c_str()));
+            }
+            else if(arg == "--warmup"){
+                _opts.warmup = std::max(0, std::atoi(value.c_str()));
+            }
+            else if(arg == "--filter"){
+                _opts.filter = value;
+            }
+            else if(arg == "--out"){
+                _opts.out = value;
+            }
+            else{
+                return false;
+            }
+        }
+
+        return true;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Options opts;
+    if(!parseOptions(argc, argv, opts)){
+        std::cerr << "usage: lisp_bench [--reps N] [--warmup N] [--filter S] [--out FILE]" << std::endl;
+        return 2;
+    }
+
+    lisp::Environment::initGlobalEnvir();
+
+    std::vector<Result> results;
+    for(auto &work : workloads){
+        if(selected(opts, work.name)){
+            results.push_back(runWorkload(work, opts));
+        }
+    }
+
+#ifndef _WIN32
+    if(selected(opts, "green-memory")){
+        results.push_back(runGreenMemory(opts));
+    }
+#endif
+
+#ifndef _WIN32
+    if(selected(opts, "shard-map-fault")){
+        results.push_back(runShardFault(opts, false));
+    }
+
+    if(selected(opts, "shard-map-hang")){
+        results.push_back(runShardFault(opts, true));
+    }
+#endif
+
+    if(selected(opts, "ast-borrow")){
+        results.push_back(runBorrow(opts));
+    }
+
+    if(selected(opts, "budget-recovery")){
+        results.push_back(runRecovery(opts));
+    }
+
+    if(selected(opts, "closure-retain")){
+        results.push_back(runRetention(opts));
+    }
+
+    if(selected(opts, "stream-pipeline")){
+        results.push_back(runStream(opts));
+    }
+
+    if(selected(opts, "parser")){
+        results.push_back(runParser(opts));
+    }
+
+    if(selected(opts, "text-lines")){
+        results.push_back(runText(opts));
+    }
+
+    const struct{const char *name; bool json, write;} serials[] = {
+        {"serial-write-sexpr", false, true},
+        {"serial-read-sexpr", false, false},
+        {"serial-write-json", true, true},
+        {"serial-read-json", true, false},
+    };
+    for(auto &serial : serials){
+        if(selected(opts, serial.name)){
+            results.push_back(runSerial(opts, serial.name, serial.json, serial.write));
+        }
+    }
+
+    if(selected(opts, "reader")){
+        results.push_back(runReader(opts));
+    }
+
+    bool ok = true;
+    for(auto &r : results){
+        auto stats = summarize(r.samples);
+        std::cerr << r.name << ": "
+                  << (r.ok ? "" : "FAILED ")
+                  << "median " << stats.median / 1e6 << " ms, "
+                  << "stddev " << stats.stddev / 1e6 << " ms" << std::endl;
+        ok = ok && r.ok;
+    }
+
+    if(opts.out.empty()){
+        writeJson(std::cout, results, opts);
+    }
+    else{
+        std::ofstream fout(opts.out);
+        writeJson(fout, results, opts);
+    }
+
+    return ok ? 0 : 1;
+}
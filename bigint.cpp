@@ -0,0 +1,435 @@
+#include "bigint.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace lisp
+{
+    using Limbs = std::vector<std::uint32_t>;
+
+    // products of operands this long and longer are split, shorter ones are multiplied directly
+    static constexpr std::size_t karatsubaFrom = 32;
+    // the largest power of ten in a limb, decimal text is converted 9 digits at a time
+    static constexpr std::uint32_t chunkBase = 1000000000;
+    static constexpr int chunkDigits = 9;
+
+    static void trim(Limbs &_a)
+    {
+        while(!_a.empty() && _a.back() == 0){
+            _a.pop_back();
+        }
+    }
+
+    static int compareMag(const Limbs &_a, const Limbs &_b)
+    {
+        if(_a.size() != _b.size()){
+            return _a.size() < _b.size() ? -1 : 1;
+        }
+
+        for(auto i = _a.size(); i-- > 0;){
+            if(_a[i] != _b[i]){
+                return _a[i] < _b[i] ? -1 : 1;
+            }
+        }
+
+        return 0;
+    }
+
+    static Limbs addMag(const Limbs &_a, const Limbs &_b)
+    {
+        auto &longer = _a.size() < _b.size() ? _b : _a;
+        auto &shorter = _a.size() < _b.size() ? _a : _b;
+
+        Limbs sum(longer.size() + 1);
+        std::uint64_t carry = 0;
+        for(std::size_t i = 0; i < longer.size(); i++){
+            carry += std::uint64_t(longer[i]) + (i < shorter.size() ? shorter[i] : 0);
+            sum[i] = std::uint32_t(carry);
+            carry >>= 32;
+        }
+        sum.back() = std::uint32_t(carry);
+
+        trim(sum);
+        return sum;
+    }
+
+    // _a - _b where _a is not smaller
+    static void subInPlace(Limbs &_a, const Limbs &_b)
+    {
+        std::int64_t borrow = 0;
+        for(std::size_t i = 0; i < _a.size() && (i < _b.size() || borrow); i++){
+            std::int64_t diff = std::int64_t(_a[i]) - (i < _b.size() ? _b[i] : 0) - borrow;
+            borrow = diff < 0;
+            _a[i] = std::uint32_t(diff);
+        }
+
+        trim(_a);
+    }
+
+    // adds _b shifted by _offset limbs into _a, which is long enough
+    static void addShifted(Limbs &_a, const Limbs &_b, std::size_t _offset)
+    {
+        std::uint64_t carry = 0;
+        std::size_t i = 0;
+        for(; i < _b.size(); i++){
+            carry += std::uint64_t(_a[i + _offset]) + _b[i];
+            _a[i + _offset] = std::uint32_t(carry);
+            carry >>= 32;
+        }
+        for(i += _offset; carry; i++){
+            carry += _a[i];
+            _a[i] = std::uint32_t(carry);
+            carry >>= 32;
+        }
+    }
+
+    static Limbs mulSchool(const std::uint32_t *_a, std::size_t _n, const std::uint32_t *_b, std::size_t _m)
+    {
+        Limbs product(_n + _m, 0);
+        for(std::size_t i = 0; i < _n; i++){
+            std::uint64_t carry = 0;
+            for(std::size_t j = 0; j < _m; j++){
+                carry += std::uint64_t(_a[i]) * _b[j] + product[i + j];
+                product[i + j] = std::uint32_t(carry);
+                carry >>= 32;
+            }
+            product[i + _m] = std::uint32_t(carry);
+        }
+
+        trim(product);
+        return product;
+    }
+
+    static Limbs slice(const std::uint32_t *_a, std::size_t _n)
+    {
+        Limbs limbs(_a, _a + _n);
+        trim(limbs);
+        return limbs;
+    }
+
+    static Limbs mulMag(const std::uint32_t *_a, std::size_t _n, const std::uint32_t *_b, std::size_t _m)
+    {
+        if(_n < _m){
+            std::swap(_a, _b);
+            std::swap(_n, _m);
+        }
+
+        if(_m < karatsubaFrom){
+            return mulSchool(_a, _n, _b, _m);
+        }
+
+        auto half = _n / 2;
+
+        // a lopsided product is done in pieces of the shorter length
+        if(_m <= half){
+            Limbs product(_n + _m, 0);
+            for(std::size_t i = 0; i < _n; i += _m){
+                auto piece = mulMag(_a + i, std::min(_m, _n - i), _b, _m);
+                addShifted(product, piece, i);
+            }
+            trim(product);
+            return product;
+        }
+
+        // a = a1 B^half + a0 and b = b1 B^half + b0, three half size products instead of four
+        auto a0 = slice(_a, half), a1 = slice(_a + half, _n - half);
+        auto b0 = slice(_b, half), b1 = slice(_b + half, _m - half);
+
+        auto low = mulMag(a0.data(), a0.size(), b0.data(), b0.size());
+        auto high = mulMag(a1.data(), a1.size(), b1.data(), b1.size());
+        auto sa = addMag(a0, a1), sb = addMag(b0, b1);
+        auto middle = mulMag(sa.data(), sa.size(), sb.data(), sb.size());
+        subInPlace(middle, low);
+        subInPlace(middle, high);
+
+        Limbs product(_n + _m + 1, 0);
+        addShifted(product, low, 0);
+        addShifted(product, middle, half);
+        addShifted(product, high, 2 * half);
+
+        trim(product);
+        return product;
+    }
+
+    // divides _a in place by a single limb and returns the remainder
+    static std::uint32_t divSmall(Limbs &_a, std::uint32_t _d)
+    {
+        std::uint64_t rem = 0;
+        for(auto i = _a.size(); i-- > 0;){
+            auto cur = (rem << 32) | _a[i];
+            _a[i] = std::uint32_t(cur / _d);
+            rem = cur % _d;
+        }
+
+        trim(_a);
+        return std::uint32_t(rem);
+    }
+
+    // _a * _m + _add in place
+    static void mulAddSmall(Limbs &_a, std::uint32_t _m, std::uint32_t _add)
+    {
+        std::uint64_t carry = _add;
+        for(auto &limb : _a){
+            carry += std::uint64_t(limb) * _m;
+            limb = std::uint32_t(carry);
+            carry >>= 32;
+        }
+        if(carry){
+            _a.push_back(std::uint32_t(carry));
+        }
+    }
+
+    static Limbs shiftLeft(const Limbs &_a, int _bits, std::size_t _extra)
+    {
+        Limbs shifted(_a.size() + _extra, 0);
+        std::uint32_t carry = 0;
+        for(std::size_t i = 0; i < _a.size(); i++){
+            shifted[i] = (_a[i] << _bits) | carry;
+            carry = _bits ? _a[i] >> (32 - _bits) : 0;
+        }
+        if(_extra){
+            shifted[_a.size()] = carry;
+        }
+
+        return shifted;
+    }
+
+    // long division of magnitudes, Knuth's algorithm D, _v has at least two limbs
+    static void divMag(const Limbs &_u, const Limbs &_v, Limbs &_quot, Limbs &_rem)
+    {
+        // normalized so the top limb of the divisor has its high bit set
+        int bits = __builtin_clz(_v.back());
+        auto v = shiftLeft(_v, bits, 0);
+        auto u = shiftLeft(_u, bits, 1);
+
+        auto n = v.size(), m = _u.size() - n;
+        _quot.assign(m + 1, 0);
+
+        for(auto j = m + 1; j-- > 0;){
+            auto top = (std::uint64_t(u[j + n]) << 32) | u[j + n - 1];
+            auto qhat = top / v[n - 1], rhat = top % v[n - 1];
+
+            while(qhat >> 32 || qhat * v[n - 2] > ((rhat << 32) | u[j + n - 2])){
+                qhat--;
+                rhat += v[n - 1];
+                if(rhat >> 32){
+                    break;
+                }
+            }
+
+            std::uint64_t carry = 0;
+            std::int64_t borrow = 0;
+            for(std::size_t i = 0; i < n; i++){
+                auto p = qhat * v[i] + carry;
+                carry = p >> 32;
+                std::int64_t diff = std::int64_t(u[i + j]) - std::int64_t(p & 0xffffffff) - borrow;
+                u[i + j] = std::uint32_t(diff);
+                borrow = diff < 0;
+            }
+            std::int64_t diff = std::int64_t(u[j + n]) - std::int64_t(carry) - borrow;
+            u[j + n] = std::uint32_t(diff);
+
+            // qhat was one too large, add the divisor back
+            if(diff < 0){
+                qhat--;
+                carry = 0;
+                for(std::size_t i = 0; i < n; i++){
+                    carry += std::uint64_t(u[i + j]) + v[i];
+                    u[i + j] = std::uint32_t(carry);
+                    carry >>= 32;
+                }
+                u[j + n] += std::uint32_t(carry);
+            }
+
+            _quot[j] = std::uint32_t(qhat);
+        }
+
+        _rem.assign(n, 0);
+        for(std::size_t i = 0; i < n; i++){
+            _rem[i] = bits ? (u[i] >> bits) | (u[i + 1] << (32 - bits)) : u[i];
+        }
+
+        trim(_quot);
+        trim(_rem);
+    }
+
+    BigInt::BigInt(bool _negative, Limbs &&_limbs) : negative(_negative), limbs(std::move(_limbs))
+    {
+        trim(limbs);
+        if(limbs.empty()){
+            negative = false;
+        }
+    }
+
+    BigInt::BigInt(Int _i) : negative(_i < 0)
+    {
+        // the magnitude of the smallest Int does not fit in an Int
+        auto mag = negative ? 0 - std::uint64_t(_i) : std::uint64_t(_i);
+        for(; mag; mag >>= 32){
+            limbs.push_back(std::uint32_t(mag));
+        }
+    }
+
+    std::optional<BigInt> BigInt::fromString(const std::string &_text)
+    {
+        std::size_t pos = 0;
+        bool negative = false;
+        if(!_text.empty() && (_text[0] == '-' || _text[0] == '+')){
+            negative = _text[0] == '-';
+            pos = 1;
+        }
+
+        if(pos == _text.size()){
+            return std::nullopt;
+        }
+
+        Limbs limbs;
+        limbs.reserve((_text.size() - pos) / chunkDigits + 1);
+
+        // the first chunk takes the leftover digits so the rest are whole
+        auto first = (_text.size() - pos) % chunkDigits;
+        for(auto end = pos + (first ? first : chunkDigits); pos < _text.size(); end += chunkDigits){
+            std::uint32_t chunk = 0, scale = 1;
+            for(; pos < end; pos++){
+                if(_text[pos] < '0' || _text[pos] > '9'){
+                    return std::nullopt;
+                }
+                chunk = chunk * 10 + (_text[pos] - '0');
+                scale *= 10;
+            }
+            mulAddSmall(limbs, scale, chunk);
+        }
+
+        return BigInt(negative, std::move(limbs));
+    }
+
+    bool BigInt::fitsInt() const
+    {
+        if(limbs.size() <= 1){
+            return true;
+        }
+        if(limbs.size() > 2){
+            return false;
+        }
+
+        auto mag = (std::uint64_t(limbs[1]) << 32) | limbs[0];
+        return negative ? mag <= std::uint64_t(1) << 63 : mag < std::uint64_t(1) << 63;
+    }
+
+    Int BigInt::toInt() const
+    {
+        std::uint64_t mag = 0;
+        for(auto i = limbs.size(); i-- > 0;){
+            mag = (mag << 32) | limbs[i];
+        }
+
+        return negative ? Int(0 - mag) : Int(mag);
+    }
+
+    double BigInt::toDouble() const
+    {
+        double value = 0;
+        for(auto i = limbs.size(); i-- > 0;){
+            value = value * 4294967296.0 + limbs[i];
+        }
+
+        return negative ? -value : value;
+    }
+
+    std::string BigInt::toString() const
+    {
+        if(limbs.empty()){
+            return "0";
+        }
+
+        // least significant chunk first, one single limb division per 9 digits
+        std::vector<std::uint32_t> chunks;
+        chunks.reserve(limbs.size() * 32 / 29 + 1);
+        auto rest = limbs;
+        while(!rest.empty()){
+            chunks.push_back(divSmall(rest, chunkBase));
+        }
+
+        std::string text = negative ? "-" : "";
+        text += std::to_string(chunks.back());
+        auto at = text.size();
+        text.resize(at + (chunks.size() - 1) * chunkDigits);
+
+        for(auto i = chunks.size() - 1; i-- > 0; at += chunkDigits){
+            auto chunk = chunks[i];
+            for(int d = chunkDigits; d-- > 0; chunk /= 10){
+                text[at + d] = char('0' + chunk % 10);
+            }
+        }
+
+        return text;
+    }
+
+    int BigInt::compare(const BigInt &_b) const
+    {
+        if(negative != _b.negative){
+            return negative ? -1 : 1;
+        }
+
+        auto mag = compareMag(limbs, _b.limbs);
+        return negative ? -mag : mag;
+    }
+
+    BigInt BigInt::operator-() const
+    {
+        auto copy = *this;
+        copy.negative = !copy.limbs.empty() && !negative;
+        return copy;
+    }
+
+    BigInt operator+(const BigInt &_a, const BigInt &_b)
+    {
+        if(_a.negative == _b.negative){
+            return BigInt(_a.negative, addMag(_a.limbs, _b.limbs));
+        }
+
+        // opposite signs, the larger magnitude keeps its sign
+        if(compareMag(_a.limbs, _b.limbs) >= 0){
+            auto limbs = _a.limbs;
+            subInPlace(limbs, _b.limbs);
+            return BigInt(_a.negative, std::move(limbs));
+        }
+
+        auto limbs = _b.limbs;
+        subInPlace(limbs, _a.limbs);
+        return BigInt(_b.negative, std::move(limbs));
+    }
+
+    BigInt operator-(const BigInt &_a, const BigInt &_b)
+    {
+        return _a + -_b;
+    }
+
+    BigInt operator*(const BigInt &_a, const BigInt &_b)
+    {
+        return BigInt(_a.negative != _b.negative,
+            mulMag(_a.limbs.data(), _a.limbs.size(), _b.limbs.data(), _b.limbs.size()));
+    }
+
+    void BigInt::divide(const BigInt &_a, const BigInt &_b, BigInt &_quot, BigInt &_rem)
+    {
+        Limbs quot, rem;
+
+        if(compareMag(_a.limbs, _b.limbs) < 0){
+            rem = _a.limbs;
+        }
+        else if(_b.limbs.size() == 1){
+            quot = _a.limbs;
+            auto r = divSmall(quot, _b.limbs[0]);
+            if(r){
+                rem.push_back(r);
+            }
+        }
+        else{
+            divMag(_a.limbs, _b.limbs, quot, rem);
+        }
+
+        _quot = BigInt(_a.negative != _b.negative, std::move(quot));
+        _rem = BigInt(_a.negative, std::move(rem));
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace lisp
+{
+    // fixnums, promoted to BigInt when a result leaves their range
+    using Int = std::int64_t;
+
+    // integers of any size, a sign and magnitude in 32 bit limbs, least significant first
+    class BigInt{
+        private:
+            using Limbs = std::vector<std::uint32_t>;
+            bool negative = false;
+            Limbs limbs;    // no leading zero limbs, empty for zero
+
+            BigInt(bool _negative, Limbs &&_limbs);
+
+        public:
+            BigInt() = default;
+            explicit BigInt(Int _i);
+            // decimal digits with an optional sign
+            static std::optional<BigInt> fromString(const std::string &_text);
+
+            bool isZero() const {return limbs.empty();}
+            bool fitsInt() const;
+            // only meaningful when fitsInt()
+            Int toInt() const;
+            double toDouble() const;
+            std::string toString() const;
+
+            // negative, zero or positive like strcmp
+            int compare(const BigInt &_b) const;
+            bool operator==(const BigInt &_b) const {return negative == _b.negative && limbs == _b.limbs;}
+            bool operator!=(const BigInt &_b) const {return !(*this == _b);}
+
+            BigInt operator-() const;
+            friend BigInt operator+(const BigInt &_a, const BigInt &_b);
+            friend BigInt operator-(const BigInt &_a, const BigInt &_b);
+            friend BigInt operator*(const BigInt &_a, const BigInt &_b);
+            // truncating division, the remainder takes the sign of the dividend, _b must not be zero
+            static void divide(const BigInt &_a, const BigInt &_b, BigInt &_quot, BigInt &_rem);
+    };
+}
@@ -1,28 +1,68 @@
 #include "lisp.h"
+#include "macro.h"
+#include <algorithm>
+#include <cstdint>
 
 namespace lisp
 {
-    std::optional<Cell> lisp::Procedure::operator()(const List &_args, PtrEnvir &_envir)
+    std::optional<Cell> lisp::Procedure::operator()(Args _args, PtrEnvir &_envir)
     {
-        auto args = flatten(_args, _envir);
-        if(!args){
-            std::cerr << "Procedure: fail to eval args" << std::endl;
+        if(_args.size() != code->params.size()){
+            std::cerr << "Procedure: fail to bind args" << std::endl;
             return std::nullopt;
         }
 
-        auto newEnvir = Environment::createEnvir(envir);
+        if(!Meter::alloc(sizeof(Environment) + _args.size() * sizeof(Cell))){
+            return std::nullopt;
+        }
+
+        // args are evaluated straight into the new frame, it is not visible to them yet
+        auto newEnvir = Environment::createEnvir(envir, code->assigned);
+        auto param = code->params.begin();
+
+        for(auto &arg : _args){
+            auto value = evaluate(arg, _envir);
+            if(!value){
+                std::cerr << "Procedure: fail to eval args" << std::endl;
+                return std::nullopt;
+            }
+
+            if(!newEnvir->extend(*param++, std::move(value.value()))){
+                std::cerr << "Procedure: fail to bind args" << std::endl;
+                return std::nullopt;
+            }
+        }
+
+        return evaluate(code->body, newEnvir);
+    }
 
-        if(!newEnvir->bind(params, args.value())){
+    std::optional<Cell> lisp::Procedure::invoke(std::vector<Cell> &_values)
+    {
+        if(_values.size() != code->params.size()){
             std::cerr << "Procedure: fail to bind args" << std::endl;
             return std::nullopt;
         }
 
-        return evaluate(body, newEnvir);
+        if(!Meter::alloc(sizeof(Environment) + _values.size() * sizeof(Cell))){
+            return std::nullopt;
+        }
+
+        auto newEnvir = Environment::createEnvir(envir, code->assigned);
+        auto param = code->params.begin();
+
+        for(auto &value : _values){
+            if(!newEnvir->extend(*param++, std::move(value))){
+                std::cerr << "Procedure: fail to bind args" << std::endl;
+                return std::nullopt;
+            }
+        }
+
+        return evaluate(code->body, newEnvir);
     }
 
     // primary
     // (if <cond> <expr1> <expr2>)
-    std::optional<Cell> buildinIf(const List &_args, PtrEnvir &_envir)
+    std::optional<Cell> buildinIf(Args _args, PtrEnvir &_envir)
     {
         if(_args.size() != 3){
             std::cerr << "if: need 3 args" << std::endl;
@@ -45,7 +85,7 @@ namespace lisp
     //(cond (<cond1> <expr1>) (<cond2> <expr2>) ... (<condn> <exprn>) <default>)
     // <=> (if <cond1> <expr1> (cond (<cond2> <expr2>) ... (<condn> <exprn>) <default>))
     // (if <cond> <expr1> <expr2>) <=> (cond (<cond> <expr1>) <expr2>)
-    std::optional<Cell> buildinCond(const List &_args, PtrEnvir &_envir)
+    std::optional<Cell> buildinCond(Args _args, PtrEnvir &_envir)
     {
         if(_args.size() < 2){
             std::cerr << "cond: too less args" << std::endl;
@@ -63,7 +103,7 @@ namespace lisp
                 return std::nullopt;
             }
 
-            auto list = it->get<List>();
+            auto &list = it->ref<List>();
             if(list.size() != 2){
                 std::cerr << "cond: invalid args" << std::endl;
                 return std::nullopt;
@@ -84,36 +124,49 @@ namespace lisp
     }
 
     // (lambda (<param1> ... <paramn>) <body>)
-    std::optional<Cell> buildinLambda(const List &_args, PtrEnvir &_envir)
+    std::optional<Cell> buildinLambda(Args _args, PtrEnvir &_envir)
     {
         if(_args.size() != 2){
             std::cerr << "lambda: need 2 args" << std::endl;
             return std::nullopt;
         }
 
+        // the form was evaluated before, its analysis is in place of the params
         auto &first = _args.front();
-        if(!first.isType<List>()){
-            std::cerr << "lambda: invalid param list" << std::endl;
-            return std::nullopt;
-        }
+        PtrLambda code = first.isType<PtrObject>()
+            ? std::dynamic_pointer_cast<const Lambda>(first.ref<PtrObject>()) : nullptr;
 
-        std::vector<std::string> paramList;
-        for(auto param : first.get<List>()){
-            if(!param.isType<std::string>()){
-                std::cerr << "lambda: invalid param" << std::endl;
+        if(!code){
+            if(!first.isType<List>()){
+                std::cerr << "lambda: invalid param list" << std::endl;
                 return std::nullopt;
             }
 
-            paramList.push_back(param.get<std::string>());
+            std::vector<std::string> paramList;
+            for(auto &param : first.ref<List>()){
+                if(!param.isType<std::string>()){
+                    std::cerr << "lambda: invalid param" << std::endl;
+                    return std::nullopt;
+                }
+
+                paramList.push_back(param.ref<std::string>());
+            }
+
+            // macro uses in the body were rewritten by expandAll on the enclosing form before it
+            // was evaluated, see macro.h, so the analysis sees the names they bind or set!
+            auto &body = const_cast<Cell &>(_args.back());
+            auto made = std::make_shared<Lambda>(std::move(paramList), std::move(body));
+            body = false;
+            const_cast<Cell &>(first) = PtrObject(made);
+            code = made;
         }
 
-        Procedure proc(paramList, _args.back(), _envir);
-        auto ptr = std::make_shared<Procedure>(std::move(proc));
-        return Cell(ptr);
+        auto envir = Procedure::flatCapture ? _envir->capture(code->free) : nullptr;
+        return Cell(std::make_shared<Procedure>(code, envir ? envir : _envir));
     }
 
     // (define <name> <value>)
-    std::optional<Cell> buildinDefine(const List &_args, PtrEnvir &_envir)
+    std::optional<Cell> buildinDefine(Args _args, PtrEnvir &_envir)
     {
         if(_args.size() != 2){
             std::cerr << "define: need 2 args" << std::endl;
@@ -132,15 +185,15 @@ namespace lisp
             return std::nullopt;
         }
 
-        if(!_envir->extend(name.get<std::string>(), value.value())){
+        if(!_envir->extend(name.ref<std::string>(), std::move(value.value()))){
             std::cerr << "define: name conflict" << std::endl;
             return std::nullopt;
         }
 
-        return name.get<std::string>();
+        return name;
     }
 
-    std::optional<Cell> buildinBegin(const List &_args, PtrEnvir &_envir)
+    std::optional<Cell> buildinBegin(Args _args, PtrEnvir &_envir)
     {
         if(_args.empty()){
             std::cerr << "begin: empty args" << std::endl;
@@ -158,17 +211,78 @@ namespace lisp
         }
     }
 
+    // (let <name> (<var1> <expr1>) ... (<varn> <exprn>) <body>), <name> is bound in <body> to a procedure
+    // of <var1> ... <varn>, so the body can loop by calling it
+    static std::optional<Cell> namedLet(Args _args, PtrEnvir &_envir)
+    {
+        auto &name = _args.front().ref<std::string>();
+        auto bindings = _args.tail();
+        if(bindings.size() < 2){
+            std::cerr << "let: too less args" << std::endl;
+            return std::nullopt;
+        }
+
+        if(!Meter::alloc(sizeof(Environment) + sizeof(Procedure) + (bindings.size() - 1) * sizeof(Cell))){
+            return std::nullopt;
+        }
+
+        std::vector<std::string> params;
+        std::vector<Cell> values;
+
+        auto last = --bindings.end();
+        for(auto it = bindings.begin(); it != last; it++){
+            if(!it->isType<List>() || it->ref<List>().size() != 2 || !it->ref<List>().front().isType<std::string>()){
+                std::cerr << "let: invalid args" << std::endl;
+                return std::nullopt;
+            }
+
+            auto value = evaluate(it->ref<List>().back(), _envir);
+            if(!value){
+                std::cerr << "let: invalid value" << std::endl;
+                return std::nullopt;
+            }
+
+            params.push_back(it->ref<List>().front().ref<std::string>());
+            values.push_back(std::move(value.value()));
+        }
+
+        // the procedure closes over the frame that binds it
+        auto frame = Environment::createEnvir(_envir);
+        auto proc = std::make_shared<Procedure>(std::make_shared<Lambda>(std::move(params), *last), frame);
+        if(!frame->extend(name, Cell(proc))){
+            std::cerr << "let: fail to bind vars" << std::endl;
+            return std::nullopt;
+        }
+
+        auto result = proc->invoke(values);
+
+        // nothing kept the loop, break the frame <-> procedure cycle so both are freed
+        if(frame.use_count() == 2 && proc.use_count() == 2){
+            frame->setVar(name, false);
+        }
+
+        return result;
+    }
+
     //(let (<var1> <expr1>) ... (<varn> <exprn>) <body>)
     // => ((lambda (<var1> ... <varn>) <body>) <expr1> ... <exprn>)
-    std::optional<Cell> buildinLet(const List &_args, PtrEnvir &_envir)
+    std::optional<Cell> buildinLet(Args _args, PtrEnvir &_envir)
     {
         if(_args.size() < 2){
             std::cerr << "let: too less args" << std::endl;
             return std::nullopt;
         }
 
-        std::vector<std::string> vars;
-        List values;
+        if(_args.front().isType<std::string>()){
+            return namedLet(_args, _envir);
+        }
+
+        if(!Meter::alloc(sizeof(Environment) + (_args.size() - 1) * sizeof(Cell))){
+            return std::nullopt;
+        }
+
+        // values are evaluated in _envir, the new frame is not visible to them yet
+        auto newEnvir = Environment::createEnvir(_envir);
 
         auto last = --_args.end();
         for(auto it = _args.begin(); it != last; it++){
@@ -177,13 +291,13 @@ namespace lisp
                 return std::nullopt;
             }
 
-            auto list = it->get<List>();
+            auto &list = it->ref<List>();
             if(list.size() != 2){
                 std::cerr << "let: invalid args" << std::endl;
                 return std::nullopt;
             }
 
-            auto var = list.front();
+            auto &var = list.front();
             if(!var.isType<std::string>()){
                 std::cerr << "let: invalid var name" << std::endl;
                 return std::nullopt;
@@ -195,20 +309,16 @@ namespace lisp
                 return std::nullopt;
             }
 
-            vars.push_back(var.get<std::string>());
-            values.push_back(value.value());
-        }
-
-        auto newEnvir = Environment::createEnvir(_envir);
-        if(!newEnvir->bind(vars, values)){
-            std::cerr << "let: fail to bind vars" << std::endl;
-            return std::nullopt;
+            if(!newEnvir->extend(var.ref<std::string>(), std::move(value.value()))){
+                std::cerr << "let: fail to bind vars" << std::endl;
+                return std::nullopt;
+            }
         }
 
         return evaluate(*last, newEnvir);
     }
 
-    std::optional<Cell> buildinAtom(const List &_args, PtrEnvir &_envir)
+    std::optional<Cell> buildinAtom(Args _args, PtrEnvir &)
     {
         if(_args.size() != 1){
             std::cerr << "atom?: need 1 arg" << std::endl;
@@ -219,7 +329,7 @@ namespace lisp
     }
 
     // (set! <name> <value>)
-    std::optional<Cell> buildinSet(const List &_args, PtrEnvir &_envir)
+    std::optional<Cell> buildinSet(Args _args, PtrEnvir &_envir)
     {
         if(_args.size() != 2){
             std::cerr << "set!: need 2 args" << std::endl;
@@ -238,75 +348,508 @@ namespace lisp
             return std::nullopt;
         }
 
-        if(!_envir->setVar(name.get<std::string>(), value.value())){
+        if(!_envir->setVar(name.ref<std::string>(), value.value())){
             std::cerr << "set!: fail, maybe var not exist" << std::endl;
             return std::nullopt;
         }
 
-        return name.get<std::string>();
+        return name;
+    }
+
+    // (quote <expr>)
+    std::optional<Cell> buildinQuote(Args _args, PtrEnvir &)
+    {
+        if(_args.size() != 1){
+            std::cerr << "quote: need 1 arg" << std::endl;
+            return std::nullopt;
+        }
+
+        return _args.front();
+    }
+
+    // List Operate
+    // native lists are List values, their operands are already evaluated by wrap
+
+    // a procedure made from one of the closure pair lambdas below
+    static Cell procedureOf(const Cell &_lambda)
+    {
+        auto envir = Environment::createEnvir();
+        return evaluate(_lambda, envir).value();
+    }
+
+    static bool isList(const Cell &_cell, const char *_name)
+    {
+        if(!_cell.isType<List>()){
+            std::cerr << _name << ": need a list" << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    // (list <value1> ... <valuen>)
+    std::optional<Cell> buildinList(Args _args, PtrEnvir &)
+    {
+        return List(_args.begin(), _args.end());
+    }
+
+    // (cons <x> <list>) prepends to a native list, any other pair is a closure
+    std::optional<Cell> buildinListCons(Args _args, PtrEnvir &_envir)
+    {
+        if(_args.size() == 2 && _args.back().isType<List>()){
+            auto list = _args.back().get<List>();
+            list.push_front(_args.front());
+            return list;
+        }
+
+        static const Cell pair = procedureOf(buildinCons);
+        std::vector<Cell> values(_args.begin(), _args.end());
+        return applyValues(pair, values, _envir);
+    }
+
+    std::optional<Cell> buildinListCar(Args _args, PtrEnvir &_envir)
+    {
+        if(_args.size() == 1 && _args.front().isType<List>()){
+            auto &list = _args.front().ref<List>();
+            if(list.empty()){
+                std::cerr << "car: empty list" << std::endl;
+                return std::nullopt;
+            }
+
+            return list.front();
+        }
+
+        static const Cell car = procedureOf(buildinCar);
+        std::vector<Cell> values(_args.begin(), _args.end());
+        return applyValues(car, values, _envir);
+    }
+
+    std::optional<Cell> buildinListCdr(Args _args, PtrEnvir &_envir)
+    {
+        if(_args.size() == 1 && _args.front().isType<List>()){
+            auto &list = _args.front().ref<List>();
+            if(list.empty()){
+                std::cerr << "cdr: empty list" << std::endl;
+                return std::nullopt;
+            }
+
+            return List(++list.begin(), list.end());
+        }
+
+        static const Cell cdr = procedureOf(buildinCdr);
+        std::vector<Cell> values(_args.begin(), _args.end());
+        return applyValues(cdr, values, _envir);
+    }
+
+    std::optional<Cell> buildinNull(Args _args, PtrEnvir &)
+    {
+        if(_args.size() != 1){
+            std::cerr << "null?: need 1 arg" << std::endl;
+            return std::nullopt;
+        }
+
+        return _args.front().isType<List>() && _args.front().ref<List>().empty();
+    }
+
+    std::optional<Cell> buildinLength(Args _args, PtrEnvir &)
+    {
+        if(_args.size() != 1 || !isList(_args.front(), "length")){
+            return std::nullopt;
+        }
+
+        return int(_args.front().ref<List>().size());
+    }
+
+    // (append <list1> ... <listn>)
+    std::optional<Cell> buildinAppend(Args _args, PtrEnvir &)
+    {
+        List result;
+
+        for(auto &arg : _args){
+            if(!isList(arg, "append")){
+                return std::nullopt;
+            }
+
+            auto &list = arg.ref<List>();
+            result.insert(result.end(), list.begin(), list.end());
+        }
+
+        return result;
+    }
+
+    std::optional<Cell> buildinReverse(Args _args, PtrEnvir &)
+    {
+        if(_args.size() != 1 || !isList(_args.front(), "reverse")){
+            return std::nullopt;
+        }
+
+        auto list = _args.front().get<List>();
+        list.reverse();
+        return list;
+    }
+
+    // (list-ref <list> <k>)
+    std::optional<Cell> buildinListRef(Args _args, PtrEnvir &)
+    {
+        if(_args.size() != 2 || !isList(_args.front(), "list-ref") || !_args.back().isType<Int>()){
+            std::cerr << "list-ref: need a list and an index" << std::endl;
+            return std::nullopt;
+        }
+
+        auto &list = _args.front().ref<List>();
+        auto k = _args.back().get<Int>();
+        if(k < 0 || std::size_t(k) >= list.size()){
+            std::cerr << "list-ref: index out of range" << std::endl;
+            return std::nullopt;
+        }
+
+        return *std::next(list.begin(), k);
+    }
+
+    // (assoc <key> <alist>) is the first list in alist starting with key, or false
+    std::optional<Cell> buildinAssoc(Args _args, PtrEnvir &)
+    {
+        if(_args.size() != 2 || !isList(_args.back(), "assoc")){
+            return std::nullopt;
+        }
+
+        for(auto &entry : _args.back().ref<List>()){
+            if(entry.isType<List>()){
+                auto &pair = entry.ref<List>();
+                if(!pair.empty() && pair.front() == _args.front()){
+                    return entry;
+                }
+            }
+        }
+
+        return false;
+    }
+
+    // (map <f> <list1> ... <listn>) stops at the shortest list
+    std::optional<Cell> buildinMap(Args _args, PtrEnvir &_envir)
+    {
+        if(_args.size() < 2){
+            std::cerr << "map: too less args" << std::endl;
+            return std::nullopt;
+        }
+
+        std::vector<const List *> lists;
+        for(auto it = ++_args.begin(); it != _args.end(); it++){
+            if(!isList(*it, "map")){
+                return std::nullopt;
+            }
+
+            lists.push_back(&it->ref<List>());
+        }
+
+        std::vector<List::const_iterator> its;
+        for(auto list : lists){
+            its.push_back(list->begin());
+        }
+
+        List result;
+        std::vector<Cell> values;
+
+        while(true){
+            for(std::size_t i = 0; i < lists.size(); i++){
+                if(its[i] == lists[i]->end()){
+                    return result;
+                }
+
+                values.push_back(*its[i]++);
+            }
+
+            auto value = applyValues(_args.front(), values, _envir);
+            if(!value){
+                return std::nullopt;
+            }
+
+            result.push_back(std::move(value.value()));
+            values.clear();
+        }
+    }
+
+    // (filter <pred> <list>)
+    std::optional<Cell> buildinFilter(Args _args, PtrEnvir &_envir)
+    {
+        if(_args.size() != 2 || !isList(_args.back(), "filter")){
+            return std::nullopt;
+        }
+
+        List result;
+        for(auto &x : _args.back().ref<List>()){
+            auto keep = applyOne(_args.front(), x, _envir);
+            if(!(keep && keep.value().isType<bool>())){
+                std::cerr << "filter: invalid condition" << std::endl;
+                return std::nullopt;
+            }
+
+            if(keep.value().get<bool>()){
+                result.push_back(x);
+            }
+        }
+
+        return result;
+    }
+
+    // (foldl <f> <init> <list>) => (f xn ... (f x2 (f x1 init)))
+    std::optional<Cell> buildinFoldl(Args _args, PtrEnvir &_envir)
+    {
+        if(_args.size() != 3 || !isList(_args.back(), "foldl")){
+            return std::nullopt;
+        }
+
+        auto it = ++_args.begin();
+        std::optional<Cell> acc = *it;
+
+        for(auto &x : _args.back().ref<List>()){
+            acc = applyTwo(_args.front(), x, acc.value(), _envir);
+            if(!acc){
+                return std::nullopt;
+            }
+        }
+
+        return acc;
+    }
+
+    // (foldr <f> <init> <list>) => (f x1 (f x2 ... (f xn init)))
+    std::optional<Cell> buildinFoldr(Args _args, PtrEnvir &_envir)
+    {
+        if(_args.size() != 3 || !isList(_args.back(), "foldr")){
+            return std::nullopt;
+        }
+
+        auto it = ++_args.begin();
+        std::optional<Cell> acc = *it;
+        auto &list = _args.back().ref<List>();
+
+        for(auto x = list.rbegin(); x != list.rend(); x++){
+            acc = applyTwo(_args.front(), *x, acc.value(), _envir);
+            if(!acc){
+                return std::nullopt;
+            }
+        }
+
+        return acc;
+    }
+
+    // (for-each <f> <list>)
+    std::optional<Cell> buildinForEach(Args _args, PtrEnvir &_envir)
+    {
+        if(_args.size() != 2 || !isList(_args.back(), "for-each")){
+            return std::nullopt;
+        }
+
+        for(auto &x : _args.back().ref<List>()){
+            if(!applyOne(_args.front(), x, _envir)){
+                return std::nullopt;
+            }
+        }
+
+        return true;
+    }
+
+    // Integers, fixnums that overflow are redone as bignums and bignum results that fit become fixnums
+
+    static bool isInteger(const Cell &_cell)
+    {
+        return _cell.isType<Int>() || _cell.isType<BigInt>();
+    }
+
+    static Cell integerOf(BigInt &&_big)
+    {
+        if(_big.fitsInt()){
+            return _big.toInt();
+        }
+        return std::move(_big);
+    }
+
+    // borrows a bignum operand, a fixnum is converted into _tmp
+    static const BigInt &bigOf(const Cell &_cell, BigInt &_tmp)
+    {
+        if(_cell.isType<BigInt>()){
+            return _cell.ref<BigInt>();
+        }
+
+        _tmp = BigInt(_cell.get<Int>());
+        return _tmp;
+    }
+
+    static std::optional<Cell> integerAdd(const Cell &_a, const Cell &_b)
+    {
+        Int sum;
+        if(_a.isType<Int>() && _b.isType<Int>() && !__builtin_add_overflow(_a.get<Int>(), _b.get<Int>(), &sum)){
+            return sum;
+        }
+
+        BigInt x, y;
+        return integerOf(bigOf(_a, x) + bigOf(_b, y));
+    }
+
+    static std::optional<Cell> integerSub(const Cell &_a, const Cell &_b)
+    {
+        Int diff;
+        if(_a.isType<Int>() && _b.isType<Int>() && !__builtin_sub_overflow(_a.get<Int>(), _b.get<Int>(), &diff)){
+            return diff;
+        }
+
+        BigInt x, y;
+        return integerOf(bigOf(_a, x) - bigOf(_b, y));
+    }
+
+    static std::optional<Cell> integerMul(const Cell &_a, const Cell &_b)
+    {
+        Int product;
+        if(_a.isType<Int>() && _b.isType<Int>() && !__builtin_mul_overflow(_a.get<Int>(), _b.get<Int>(), &product)){
+            return product;
+        }
+
+        BigInt x, y;
+        return integerOf(bigOf(_a, x) * bigOf(_b, y));
+    }
+
+    // truncating like C++, _quotient picks the quotient or the remainder
+    static std::optional<Cell> integerDivide(const Cell &_a, const Cell &_b, bool _quotient, const char *_name)
+    {
+        if(_b.isType<Int>() && _b.get<Int>() == 0){
+            std::cerr << _name << ": division by zero" << std::endl;
+            return std::nullopt;
+        }
+
+        // only the smallest fixnum over -1 overflows
+        if(_a.isType<Int>() && _b.isType<Int>() && !(_a.get<Int>() == INT64_MIN && _b.get<Int>() == -1)){
+            return _quotient ? _a.get<Int>() / _b.get<Int>() : _a.get<Int>() % _b.get<Int>();
+        }
+
+        BigInt x, y, quot, rem;
+        BigInt::divide(bigOf(_a, x), bigOf(_b, y), quot, rem);
+        return integerOf(_quotient ? std::move(quot) : std::move(rem));
+    }
+
+    static int integerCompare(const Cell &_a, const Cell &_b)
+    {
+        if(_a.isType<Int>() && _b.isType<Int>()){
+            return (_a.get<Int>() > _b.get<Int>()) - (_a.get<Int>() < _b.get<Int>());
+        }
+
+        BigInt x, y;
+        return bigOf(_a, x).compare(bigOf(_b, y));
+    }
+
+    using IntegerOp = std::optional<Cell> (*)(const Cell &, const Cell &);
+
+    // integer operands folded from the left, std::nullopt leaves them to the next overload
+    static Embedded integerReducer(IntegerOp _f)
+    {
+        return [_f](Args _args, PtrEnvir &) -> std::optional<Cell>
+            {
+                if(_args.size() < 2 || !std::all_of(_args.begin(), _args.end(), isInteger)){
+                    return std::nullopt;
+                }
+
+                auto it = _args.begin();
+                std::optional<Cell> acc = *it++;
+                for(; acc && it != _args.end(); it++){
+                    acc = _f(acc.value(), *it);
+                }
+
+                return acc;
+            };
+    }
+
+    static Embedded integerBinary(IntegerOp _f)
+    {
+        return [_f](Args _args, PtrEnvir &) -> std::optional<Cell>
+            {
+                if(_args.size() != 2 || !isInteger(_args.front()) || !isInteger(_args.back())){
+                    return std::nullopt;
+                }
+
+                return _f(_args.front(), _args.back());
+            };
+    }
+
+    static Embedded integerPredicate(bool (*_f)(int))
+    {
+        return [_f](Args _args, PtrEnvir &) -> std::optional<Cell>
+            {
+                if(_args.size() != 2 || !isInteger(_args.front()) || !isInteger(_args.back())){
+                    return std::nullopt;
+                }
+
+                return _f(integerCompare(_args.front(), _args.back()));
+            };
     }
 
     // Arithmetic
-    Embedded plus = makeOverloadReducer<int, float>(
-        std::plus<int>(),
-        std::plus<float>()
-    ),
-    minus = makeOverload
-    <
-        int (int), float (float),
-        int (int, int), float (float, float)
-    >(
-        std::negate<int>(),
-        std::negate<float>(),
-        std::minus<int>(),
-        std::minus<float>()
-    ),
-    multiplies = makeOverloadReducer<int, float>(
-        std::multiplies<int>(),
-        std::multiplies<float>()
-    ),
-    divides = makeOverload<int (int, int), float (float, float)>(
-        std::divides<int>(),
-        std::divides<float>()
-    ),
-    modulus = makeEmbed<int (int, int)>(std::modulus<int>());
+    Embedded plus = wrap(makeOverloadSub({
+        integerReducer(integerAdd),
+        makeReducerSub(std::function<double (double, double)>(std::plus<double>()))
+    })),
+    minus = wrap(makeOverloadSub({
+        integerBinary(integerSub),
+        makeEmbedSub(std::function<double (double, double)>(std::minus<double>())),
+        // negation, the same as 0 - x
+        [](Args _args, PtrEnvir &) -> std::optional<Cell>
+        {
+            if(_args.size() != 1 || !isInteger(_args.front())){
+                return std::nullopt;
+            }
+            return integerSub(Int(0), _args.front());
+        },
+        makeEmbedSub(std::function<double (double)>(std::negate<double>()))
+    })),
+    multiplies = wrap(makeOverloadSub({
+        integerReducer(integerMul),
+        makeReducerSub(std::function<double (double, double)>(std::multiplies<double>()))
+    })),
+    divides = wrap(makeOverloadSub({
+        integerBinary([](const Cell &_a, const Cell &_b){return integerDivide(_a, _b, true, "/");}),
+        makeEmbedSub(std::function<double (double, double)>(std::divides<double>()))
+    })),
+    modulus = wrap(integerBinary([](const Cell &_a, const Cell &_b){return integerDivide(_a, _b, false, "mod");}));
 
     // Comparisons
     Embedded equal = makeOverload
     <
-        bool (bool, bool), bool (int, int), bool (float, float),
+        bool (bool, bool), bool (Int, Int), bool (BigInt, BigInt), bool (double, double),
         bool (std::string, std::string),
-        bool (Quotation, Quotation)
+        bool (Quotation, Quotation), bool (String, String),
+        bool (Vector, Vector), bool (Map, Map)
     >(
         std::equal_to<bool>(),
-        std::equal_to<int>(),
-        std::equal_to<float>(),
+        std::equal_to<Int>(),
+        std::equal_to<BigInt>(),
+        std::equal_to<double>(),
         std::equal_to<std::string>(),
-        std::equal_to<Quotation>()
-    ),
-    less = makeOverload<bool (int, int), bool (float, float)>(
-        std::less<int>(),
-        std::less<float>()
-    ),
-    greater = makeOverload<bool (int, int), bool (float, float)>(
-        std::greater<int>(),
-        std::greater<float>()
-    ),
-    lessEqual = makeOverload<bool (int, int), bool (float, float)>(
-        std::less_equal<int>(),
-        std::less_equal<float>()
+        std::equal_to<Quotation>(),
+        std::equal_to<String>(),
+        std::equal_to<Vector>(),
+        std::equal_to<Map>()
     ),
-    greaterEqual = makeOverload<bool (int, int), bool (float, float)>(
-        std::greater_equal<int>(),
-        std::greater_equal<float>()
-    );
+    less = wrap(makeOverloadSub({
+        integerPredicate([](int _c){return _c < 0;}),
+        makeEmbedSub(std::function<bool (double, double)>(std::less<double>()))
+    })),
+    greater = wrap(makeOverloadSub({
+        integerPredicate([](int _c){return _c > 0;}),
+        makeEmbedSub(std::function<bool (double, double)>(std::greater<double>()))
+    })),
+    lessEqual = wrap(makeOverloadSub({
+        integerPredicate([](int _c){return _c <= 0;}),
+        makeEmbedSub(std::function<bool (double, double)>(std::less_equal<double>()))
+    })),
+    greaterEqual = wrap(makeOverloadSub({
+        integerPredicate([](int _c){return _c >= 0;}),
+        makeEmbedSub(std::function<bool (double, double)>(std::greater_equal<double>()))
+    }));
 
     // Logical
     Embedded logicalNot = makeEmbed<bool (bool)>(std::logical_not<bool>()),
     logicalAnd = makeEmbed<bool (bool, bool)>(std::logical_and<bool>()),
     logicalOr = makeEmbed<bool (bool, bool)>(std::logical_or<bool>());
 
-    //List Operate
+    // closure pairs
     Cell buildinCons = parseString(
         "(lambda (x y) (lambda (s) (if (= s 1) x y)))"
     ).value(),
@@ -5,14 +5,115 @@
 namespace lisp
 {
     // primary
-    std::optional<Cell> buildinIf(const List &_args, PtrEnvir &_envir);
-    std::optional<Cell> buildinCond(const List &_args, PtrEnvir &_envir);
-    std::optional<Cell> buildinLambda(const List &_args, PtrEnvir &_envir);
-    std::optional<Cell> buildinDefine(const List &_args, PtrEnvir &_envir);
-    std::optional<Cell> buildinBegin(const List &_args, PtrEnvir &_envir);
-    std::optional<Cell> buildinLet(const List &_args, PtrEnvir &_envir);
-    std::optional<Cell> buildinAtom(const List &_args, PtrEnvir &_envir);
-    std::optional<Cell> buildinSet(const List &_args, PtrEnvir &_envir);
+    std::optional<Cell> buildinIf(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinCond(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinLambda(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinDefine(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinBegin(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinLet(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinAtom(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinSet(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinQuote(Args _args, PtrEnvir &_envir);
+
+    // List Operate, on evaluated args
+    // Native lists are values: cons and cdr copy the whole list, and so does evaluating a name bound
+    // to one, so recursing over a list with cons, car and cdr is quadratic in its length. Loops over
+    // whole lists belong in map, filter, foldl, foldr, for-each, append and reverse, which walk it once.
+    std::optional<Cell> buildinList(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinListCons(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinListCar(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinListCdr(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinNull(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinLength(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinAppend(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinReverse(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinListRef(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinAssoc(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinMap(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinFilter(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinFoldl(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinFoldr(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinForEach(Args _args, PtrEnvir &_envir);
+
+    // Promise and Stream, a stream is () or (<first> <promise of rest>)
+    std::optional<Cell> buildinDelay(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinStreamCons(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinStreamFold(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinMakePromise(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinForce(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinStreamCar(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinStreamCdr(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinStreamNull(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinStreamMap(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinStreamFilter(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinStreamTake(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinStreamToList(Args _args, PtrEnvir &_envir);
+
+    // Reader, data forms from a file one at a time
+    std::optional<Cell> buildinOpenReader(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinReadNext(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinReaderDone(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinReaderOffset(Args _args, PtrEnvir &_envir);
+
+    // String, text values apart from identifiers
+    std::optional<Cell> buildinStringAppend(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinSubstring(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinStringLength(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinStringToNumber(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinNumberToString(Args _args, PtrEnvir &_envir);
+
+    // File, paths are strings or quoted symbols
+    std::optional<std::string> pathOf(const Cell &_cell);
+    std::optional<Cell> buildinReadFile(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinFileLines(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinOpenWriter(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinWriteString(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinWriteLine(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinCloseWriter(Args _args, PtrEnvir &_envir);
+
+    // Serial, values to and from S-expression or JSON strings
+    std::optional<Cell> buildinWriteSexpr(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinReadSexpr(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinToJson(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinFromJson(Args _args, PtrEnvir &_envir);
+
+    // Persistent vectors and maps, updates return new versions
+    std::optional<Cell> buildinVector(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinListToVector(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinVectorToList(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinVectorLength(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinVectorRef(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinVectorSet(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinVectorPush(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinVectorPop(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinHashMap(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinListToMap(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinMapToList(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinMapCount(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinMapRef(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinMapSet(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinMapRemove(Args _args, PtrEnvir &_envir);
+
+    // Macros, each use is expanded once and the form rewritten in place, see macro.h
+    std::optional<Cell> buildinDefineSyntax(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinDefmacro(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinGensym(Args _args, PtrEnvir &_envir);
+
+#ifndef _WIN32
+    // Green threads and channels, scheduled cooperatively on the calling OS thread
+    std::optional<Cell> buildinSpawn(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinYield(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinJoin(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinChan(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinSend(Args _args, PtrEnvir &_envir);
+    std::optional<Cell> buildinRecv(Args _args, PtrEnvir &_envir);
+
+    // Shards, a map over forked worker processes
+    std::optional<Cell> buildinShardMap(Args _args, PtrEnvir &_envir);
+
+    // Native modules, shared libraries registering primitives, see native.h
+    std::optional<Cell> buildinLoadNative(Args _args, PtrEnvir &_envir);
+#endif
 
     // Arithmetic
     extern Embedded plus, minus, multiplies, divides, modulus;
@@ -20,6 +121,6 @@ namespace lisp
     extern Embedded equal, less, greater, lessEqual, greaterEqual;
     // Logical
     extern Embedded logicalNot, logicalAnd, logicalOr;
-    // List Operate
+    // closure pairs, behind cons, car and cdr for anything but native lists
     extern Cell buildinCons, buildinCar, buildinCdr;
 }
\ No newline at end of file
@@ -0,0 +1,148 @@
+#include "lispbase.h"
+#include <algorithm>
+
+namespace lisp
+{
+    // identifiers bound by enclosing lambdas, lets and defines, innermost last
+    using Scope = std::vector<std::string>;
+
+    static bool isBound(const Scope &_scope, const std::string &_name)
+    {
+        return std::find(_scope.rbegin(), _scope.rend(), _name) != _scope.rend();
+    }
+
+    // also under the alias name% a macro expansion uses where the use site shadows the form
+    static bool isForm(const List &_list, const char *_name)
+    {
+        auto &head = _list.front();
+        if(!head.isType<std::string>()){
+            return false;
+        }
+
+        auto &name = head.ref<std::string>();
+        return name == _name || (!name.empty() && name.back() == '%' && name.compare(0, name.size() - 1, _name) == 0);
+    }
+
+    static void scan(const Cell &_expr, Scope &_scope, Names &_free, Names &_assigned)
+    {
+        if(_expr.isType<std::string>()){
+            auto &name = _expr.ref<std::string>();
+            if(!isBound(_scope, name)){
+                _free.insert(name);
+            }
+            return;
+        }
+
+        if(!_expr.isType<List>()){
+            return;
+        }
+
+        auto &list = _expr.ref<List>();
+        if(list.empty()){
+            return;
+        }
+
+        auto size = _scope.size();
+
+        // (quote <expr>)
+        if(isForm(list, "quote")){
+            return;
+        }
+
+        // (lambda (<param1> ... <paramn>) <body>)
+        if(isForm(list, "lambda") && list.size() == 3){
+            auto &params = *(++list.begin());
+
+            // evaluated before, its analysis stands for its body
+            auto code = params.isType<PtrObject>()
+                ? dynamic_cast<const Lambda *>(params.ref<PtrObject>().get()) : nullptr;
+            if(code){
+                for(auto &name : code->free){
+                    if(!isBound(_scope, name)){
+                        _free.insert(name);
+                    }
+                }
+                _assigned.insert(code->assigned->begin(), code->assigned->end());
+                return;
+            }
+
+            if(params.isType<List>()){
+                for(auto &param : params.ref<List>()){
+                    if(param.isType<std::string>()){
+                        _scope.push_back(param.ref<std::string>());
+                    }
+                }
+            }
+
+            scan(list.back(), _scope, _free, _assigned);
+            _scope.resize(size);
+            return;
+        }
+
+        // (let [<name>] (<var1> <expr1>) ... (<varn> <exprn>) <body>)
+        if(isForm(list, "let") && list.size() >= 3){
+            auto last = --list.end();
+            auto &name = *(++list.begin());
+            for(auto it = ++list.begin(); it != last; it++){
+                if(it->isType<List>() && it->ref<List>().size() == 2){
+                    scan(it->ref<List>().back(), _scope, _free, _assigned);
+                }
+            }
+
+            for(auto it = ++list.begin(); it != last; it++){
+                if(it->isType<List>() && it->ref<List>().size() == 2
+                    && it->ref<List>().front().isType<std::string>()){
+                    _scope.push_back(it->ref<List>().front().ref<std::string>());
+                }
+            }
+            if(name.isType<std::string>()){
+                _scope.push_back(name.ref<std::string>());
+            }
+
+            scan(*last, _scope, _free, _assigned);
+            _scope.resize(size);
+            return;
+        }
+
+        // (define <name> <value>) binds in the frame of the enclosing body
+        if(isForm(list, "define") && list.size() == 3){
+            auto &name = *(++list.begin());
+            if(name.isType<std::string>()){
+                _scope.push_back(name.ref<std::string>());
+                _assigned.insert(name.ref<std::string>());
+            }
+
+            scan(list.back(), _scope, _free, _assigned);
+            return;
+        }
+
+        // (set! <name> <value>)
+        if(isForm(list, "set!") && list.size() == 3){
+            auto &name = *(++list.begin());
+            if(name.isType<std::string>()){
+                _assigned.insert(name.ref<std::string>());
+            }
+        }
+
+        for(auto &cell : list){
+            scan(cell, _scope, _free, _assigned);
+        }
+    }
+
+    void analyzeLambda(const std::vector<std::string> &_params, const Cell &_body, Names &_free, Names &_assigned)
+    {
+        Scope scope(_params);
+        scan(_body, scope, _free, _assigned);
+    }
+
+    Lambda::Lambda(std::vector<std::string> _params, Cell _body)
+    : params(std::move(_params)), body(std::move(_body))
+    {
+        Names names;
+        analyzeLambda(params, body, free, names);
+
+        // shared by everything that assigns nothing, nullptr would mean unknown to Environment::capture
+        static const PtrNames none = std::make_shared<const Names>();
+        assigned = names.empty() ? none : std::make_shared<const Names>(std::move(names));
+    }
+}
@@ -1,9 +1,17 @@
 #include "embed.h"
+#include <algorithm>
 
 namespace lisp
 {
-    std::optional<List> flatten(const List &_args, PtrEnvir &_envir)
+    // list nodes of finished calls, reused by wrap so that operands are not allocated per call
+    static thread_local List spare;
+
+    std::optional<List> flatten(Args _args, PtrEnvir &_envir)
     {
+        if(!Meter::alloc(_args.size() * sizeof(Cell))){
+            return std::nullopt;
+        }
+
         List list;
 
         for(auto &cell : _args){
@@ -12,24 +20,67 @@ namespace lisp
                 return std::nullopt;
             }
 
-            list.push_back(newCell.value());
+            list.push_back(std::move(newCell.value()));
         }
 
         return list;
     }
 
+    // evaluate operands into nodes taken from spare
+    static bool flattenInto(List &_list, Args _args, PtrEnvir &_envir)
+    {
+        if(!Meter::alloc(_args.size() * sizeof(Cell))){
+            return false;
+        }
+
+        auto count = std::min(_args.size(), spare.size());
+        _list.splice(_list.end(), spare, spare.begin(), std::next(spare.begin(), count));
+        while(_list.size() < _args.size()){
+            _list.emplace_back(false);
+        }
+
+        auto it = _list.begin();
+
+        for(auto &cell : _args){
+            auto newCell = evaluate(cell, _envir);
+            if(!newCell){
+                return false;
+            }
+
+            *it++ = std::move(newCell.value());
+        }
+
+        return true;
+    }
+
+    // give the nodes back, dropping their values so that nothing is kept alive
+    static void release(List &_list)
+    {
+        if(spare.size() > 256){
+            return;
+        }
+
+        for(auto &cell : _list){
+            cell = false;
+        }
+
+        spare.splice(spare.end(), _list);
+    }
+
     Embedded wrap(Embedded _embed)
     {
-        return [f = _embed](const List &_args, PtrEnvir &_envir) -> std::optional<Cell>
+        return [f = _embed](Args _args, PtrEnvir &_envir) -> std::optional<Cell>
             {
-                auto args = flatten(_args, _envir);
-                
-                if(!args){
+                List args;
+
+                if(!flattenInto(args, _args, _envir)){
+                    release(args);
                     std::cerr << "wrap: fail to eval args" << std::endl;
                     return std::nullopt;
                 }
 
-                auto ret = f(args.value(), _envir);
+                auto ret = f(args, _envir);
+                release(args);
 
                 if(!ret){
                     std::cerr << "wrap: args mismatch" << std::endl;
@@ -41,7 +92,7 @@ namespace lisp
 
     Embedded makeOverloadSub(std::initializer_list<Embedded> _fs)
     {
-        return [fs = std::vector<Embedded>(_fs)](const List &_args, PtrEnvir &_envir) -> std::optional<Cell>
+        return [fs = std::vector<Embedded>(_fs)](Args _args, PtrEnvir &_envir) -> std::optional<Cell>
             {
                 for(auto &f : fs){
                     auto ret = f(_args, _envir);
@@ -2,61 +2,45 @@
 #include "lispbase.h"
 #include <vector>
 #include <numeric>
+#include <utility>
 
 namespace lisp
 {
-    std::optional<List> flatten(const List &_args, PtrEnvir &_envir);
+    // evaluated operands, moved into a new List
+    std::optional<List> flatten(Args _args, PtrEnvir &_envir);
     Embedded wrap(Embedded _embed);
     Embedded makeOverloadSub(std::initializer_list<Embedded> _fs);
     
-    template<typename R, typename T1, typename... T>
-    Embedded makeEmbedSub(std::function<R (T1, T...)> _f)
+    template<typename R, typename... T, std::size_t... I>
+    Embedded makeEmbedSub(std::function<R (T...)> _f, std::index_sequence<I...>)
     {
-        if constexpr(sizeof...(T) == 0){
-            return [f = _f](const List &_args, PtrEnvir &_envir) -> std::optional<Cell>
-                {
-                    if(_args.size() == 1){
-                        auto &cell = _args.front();
-                        if(cell.isType<T1>()){
-                            return Cell(f(cell.get<T1>()));
-                        }
-                    }
-
+        return [f = _f](Args _args, PtrEnvir &) -> std::optional<Cell>
+            {
+                if(_args.size() != sizeof...(T)){
                     return std::nullopt;
-                };
-        }
-        else{
-            return [f = _f](const List &_args, PtrEnvir &_envir) -> std::optional<Cell>
-                {
-                    if(!_args.empty()){
-                        auto &cell = _args.front();
-                        
-                        if(cell.isType<T1>()){
-                            auto arg1 = cell.get<T1>();
-                            auto embed = makeEmbedSub(
-                                (std::function<R (T...)>)
-                                [f, arg1](T... _args) -> R
-                                {
-                                    return f(arg1, _args...);
-                                }
-                            );
-                            
-                            List remain = _args;
-                            remain.pop_front();
-                            return embed(remain, _envir);
-                        }
+                }
 
-                    }
+                auto it = _args.begin();
+                const Cell *cells[] = {&*((void)I, it++)...};
 
+                if(!(cells[I]->template isType<T>() && ...)){
                     return std::nullopt;
-                };
-        }
+                }
+
+                return Cell(f(cells[I]->template ref<T>()...));
+            };
+    }
+
+    template<typename R, typename T1, typename... T>
+    Embedded makeEmbedSub(std::function<R (T1, T...)> _f)
+    {
+        return makeEmbedSub(_f, std::index_sequence_for<T1, T...>());
     }
 
     template<typename T>
     Embedded makeReducerSub(std::function<T (T, T)> _f)
     {
-        return [f = _f](const List &_args, PtrEnvir &_envir) -> std::optional<Cell>
+        return [f = _f](Args _args, PtrEnvir &) -> std::optional<Cell>
             {
                 if(_args.size() < 2){
                     return std::nullopt;
@@ -69,7 +53,7 @@ namespace lisp
                         return std::nullopt;
                     }
 
-                    args.push_back(cell.get<T>());
+                    args.push_back(cell.ref<T>());
                 }
 
                 auto init = args.back();
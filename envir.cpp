@@ -1,56 +1,66 @@
 #include "lisp.h"
 #include "lispbase.h"
+#include "macro.h"
 
 namespace lisp
 {
-    std::optional<Embedded> Environment::lookupEmbedsLocal(const std::string &_name) const
+    const Embedded *Environment::lookupEmbedsLocal(const std::string &_name) const
     {
         auto it = embeds.find(_name);
 
         if(it != embeds.end()){
-            return it->second;
+            return &it->second;
         }
 
-        return std::nullopt;
+        return nullptr;
     }
 
-    std::optional<Cell> Environment::lookupVarsLocal(const std::string &_name) const
+    const Cell *Environment::lookupVarsLocal(const std::string &_name) const
     {
-        auto it = vars.find(_name);
-
-        if(it != vars.end()){
-            return it->second;
-        }
-
-        return std::nullopt;
+        return vars.find(_name);
     }
 
-    std::optional<Embedded> Environment::lookupEmbeds(const std::string &_name) const
+    const Embedded *Environment::lookupEmbeds(const std::string &_name) const
     {
         for(auto env = this; env != nullptr; env = env->parent.get()){
+            if(env->embeds.empty()){
+                continue;
+            }
+
             auto it = env->embeds.find(_name);
 
             if(it != env->embeds.end()){
-                return it->second;
+                return &it->second;
             }
         }
 
         return globalEnvir.lookupEmbedsLocal(_name);
     }
 
-    std::optional<Cell> Environment::lookupVars(const std::string &_name) const
+    const Cell *Environment::lookupVars(const std::string &_name) const
     {
         for(auto env = this; env != nullptr; env = env->parent.get()){
-            auto it = env->vars.find(_name);
+            auto cell = env->vars.find(_name);
 
-            if(it != env->vars.end()){
-                return it->second;
+            if(cell){
+                return cell;
             }
         }
 
         return globalEnvir.lookupVarsLocal(_name);
     }
 
+    bool Environment::bindsBefore(const std::string &_name, const Environment *_outer) const
+    {
+        for(auto env = this; env != nullptr && env != _outer; env = env->parent.get()){
+            if(env->vars.find(_name)){
+                return true;
+            }
+        }
+
+        return false;
+    }
+
     bool Environment::extend(const std::string &_name, Embedded _embed)
     {
         if(lookupEmbedsLocal(_name) || lookupVarsLocal(_name)){
@@ -63,11 +73,16 @@ namespace lisp
 
     bool Environment::extend(const std::string &_name, const Cell &_cell)
     {
-        if(lookupEmbedsLocal(_name) || lookupVarsLocal(_name)){
+        return extend(_name, Cell(_cell));
+    }
+
+    bool Environment::extend(const std::string &_name, Cell &&_cell)
+    {
+        if(vars.find(_name) || (!embeds.empty() && embeds.count(_name))){
             return false;
         }
 
-        vars.insert({_name, _cell});
+        vars.insert(_name, std::move(_cell));
         return true;
     }
 
@@ -91,10 +106,10 @@ namespace lisp
     bool Environment::setVar(const std::string &_name, const Cell &_cell)
     {
         for(auto env = this; env != nullptr; env = env->parent.get()){
-            auto it = env->vars.find(_name);
+            auto cell = env->vars.find(_name);
 
-            if(it != env->vars.end()){
-                it->second = _cell;
+            if(cell){
+                *cell = _cell;
                 return true;
             }
         }
@@ -102,10 +117,188 @@ namespace lisp
         return false;
     }
 
+    const Cell *Bindings::find(const std::string &_name) const
+    {
+        if(!index.empty()){
+            auto it = index.find(_name);
+            return it != index.end() ? &slots[it->second].second : nullptr;
+        }
+
+        for(auto &slot : slots){
+            if(slot.first == _name){
+                return &slot.second;
+            }
+        }
+
+        return nullptr;
+    }
+
+    void Bindings::insert(const std::string &_name, Cell &&_cell)
+    {
+        slots.emplace_back(_name, std::move(_cell));
+
+        if(!index.empty()){
+            index.emplace(_name, slots.size() - 1);
+        }
+        else if(slots.size() >= indexFrom){
+            for(std::size_t i = 0; i < slots.size(); i++){
+                index.emplace(slots[i].first, i);
+            }
+        }
+    }
+
+    void Bindings::clear()
+    {
+        slots.clear();
+        index.clear();
+    }
+
+    // Free frames are kept constructed, so their bindings keep their capacity, and the
+    // shared_ptr control blocks are recycled through BlockAllocator. Both lists are plain
+    // thread_local pointers, which stay valid however late the last frame is released.
+    static thread_local Environment *freeFrames = nullptr;
+    static thread_local std::size_t freeCount = 0;
+    static constexpr std::size_t poolLimit = 4096;
+
+    template<typename T>
+    class BlockAllocator{
+        private:
+            struct Block{
+                Block *next;
+            };
+
+            static_assert(sizeof(T) >= sizeof(Block));
+            static inline thread_local Block *blocks = nullptr;
+            static inline thread_local std::size_t count = 0;
+
+        public:
+            using value_type = T;
+
+            BlockAllocator() = default;
+            template<typename U>
+            BlockAllocator(const BlockAllocator<U> &) {}
+
+            T *allocate(std::size_t _n)
+            {
+                if(_n == 1 && blocks){
+                    auto block = blocks;
+                    blocks = block->next;
+                    count--;
+                    return reinterpret_cast<T *>(block);
+                }
+
+                return std::allocator<T>().allocate(_n);
+            }
+
+            void deallocate(T *_p, std::size_t _n)
+            {
+                if(_n == 1 && count < poolLimit){
+                    auto block = reinterpret_cast<Block *>(_p);
+                    block->next = blocks;
+                    blocks = block;
+                    count++;
+                    return;
+                }
+
+                std::allocator<T>().deallocate(_p, _n);
+            }
+
+            template<typename U>
+            bool operator==(const BlockAllocator<U> &) const {return true;}
+            template<typename U>
+            bool operator!=(const BlockAllocator<U> &) const {return false;}
+    };
+
+    PtrEnvir Environment::createEnvir(const PtrEnvir &_parent)
+    {
+        return createEnvir(_parent, _parent ? _parent->assigned : nullptr);
+    }
+
+    PtrEnvir Environment::createEnvir(const PtrEnvir &_parent, const PtrNames &_assigned)
+    {
+        Environment *envir = freeFrames;
+
+        if(envir){
+            freeFrames = envir->nextFree;
+            freeCount--;
+        }
+        else{
+            envir = new Environment();
+        }
+
+        envir->parent = _parent;
+        envir->assigned = _assigned;
+        return PtrEnvir(envir, release, BlockAllocator<Environment>());
+    }
+
+    void Environment::release(Environment *_envir)
+    {
+        // may release more frames, through the parent or closures bound here
+        _envir->vars.clear();
+        _envir->embeds.clear();
+        _envir->parent.reset();
+        _envir->assigned.reset();
+
+        if(freeCount >= poolLimit){
+            delete _envir;
+            return;
+        }
+
+        _envir->nextFree = freeFrames;
+        freeFrames = _envir;
+        freeCount++;
+    }
+
+    // A frame below the root holding copies of the free variables found between here and the root,
+    // nullptr when the whole chain must be kept: a variable may be set! or defined later, or is unbound.
+    // Variables of the root and the global environment stay shared through the parent link.
+    PtrEnvir Environment::capture(const Names &_free) const
+    {
+        if(!parent){
+            return nullptr;
+        }
+
+        auto root = parent;
+        while(root->parent){
+            root = root->parent;
+        }
+
+        static const PtrNames sealed = std::make_shared<Names>();
+        PtrEnvir frame;
+
+        for(auto &name : _free){
+            bool found = false;
+
+            for(auto env = this; env != root.get(); env = env->parent.get()){
+                if(!env->assigned || env->assigned->count(name) || env->embeds.count(name)){
+                    return nullptr;
+                }
+
+                auto cell = env->vars.find(name);
+                if(cell){
+                    if(!frame){
+                        frame = createEnvir(root, sealed);
+                    }
+
+                    frame->vars.insert(name, Cell(*cell));
+                    found = true;
+                    break;
+                }
+            }
+
+            if(!found && !root->lookupVars(name) && !root->lookupEmbeds(name)){
+                return nullptr;
+            }
+        }
+
+        return frame ? frame : root;
+    }
+
     Environment Environment::globalEnvir;
 
     void Environment::initGlobalEnvir()
     {
+        limitStack();
         auto &env = globalEnvir;
 
         env.embeds.insert(
@@ -118,6 +311,10 @@ namespace lisp
                 {"let", buildinLet},
                 {"atom?", buildinAtom},
                 {"set!", buildinSet},
+                {"quote", buildinQuote},
+                {"delay", buildinDelay},
+                {"stream-cons", buildinStreamCons},
+                {"stream-fold", buildinStreamFold},
 
                 {"+", plus},
                 {"-", minus},
@@ -132,17 +329,106 @@ namespace lisp
                 {"not", logicalNot},
                 {"and", logicalAnd},
                 {"or", logicalOr},
+
+                {"list", wrap(buildinList)},
+                {"cons", wrap(buildinListCons)},
+                {"car", wrap(buildinListCar)},
+                {"cdr", wrap(buildinListCdr)},
+                {"null?", wrap(buildinNull)},
+                {"length", wrap(buildinLength)},
+                {"append", wrap(buildinAppend)},
+                {"reverse", wrap(buildinReverse)},
+                {"list-ref", wrap(buildinListRef)},
+                {"assoc", wrap(buildinAssoc)},
+                {"map", wrap(buildinMap)},
+                {"filter", wrap(buildinFilter)},
+                {"foldl", wrap(buildinFoldl)},
+                {"foldr", wrap(buildinFoldr)},
+                {"for-each", wrap(buildinForEach)},
+
+                {"make-promise", wrap(buildinMakePromise)},
+                {"force", wrap(buildinForce)},
+                {"stream-car", wrap(buildinStreamCar)},
+                {"stream-cdr", wrap(buildinStreamCdr)},
+                {"stream-null?", wrap(buildinStreamNull)},
+                {"stream-map", wrap(buildinStreamMap)},
+                {"stream-filter", wrap(buildinStreamFilter)},
+                {"stream-take", wrap(buildinStreamTake)},
+                {"stream->list", wrap(buildinStreamToList)},
+
+                {"open-reader", wrap(buildinOpenReader)},
+                {"read-next", wrap(buildinReadNext)},
+                {"reader-done?", wrap(buildinReaderDone)},
+                {"reader-offset", wrap(buildinReaderOffset)},
+
+                {"string-append", wrap(buildinStringAppend)},
+                {"substring", wrap(buildinSubstring)},
+                {"string-length", wrap(buildinStringLength)},
+                {"string->number", wrap(buildinStringToNumber)},
+                {"number->string", wrap(buildinNumberToString)},
+                {"read-file", wrap(buildinReadFile)},
+                {"file-lines", wrap(buildinFileLines)},
+                {"open-writer", wrap(buildinOpenWriter)},
+                {"write-string", wrap(buildinWriteString)},
+                {"write-line", wrap(buildinWriteLine)},
+                {"close-writer", wrap(buildinCloseWriter)},
+
+                {"write-sexpr", wrap(buildinWriteSexpr)},
+                {"read-sexpr", wrap(buildinReadSexpr)},
+                {"to-json", wrap(buildinToJson)},
+                {"from-json", wrap(buildinFromJson)},
+
+                {"vector", wrap(buildinVector)},
+                {"list->vector", wrap(buildinListToVector)},
+                {"vector->list", wrap(buildinVectorToList)},
+                {"vector-length", wrap(buildinVectorLength)},
+                {"vector-ref", wrap(buildinVectorRef)},
+                {"vector-set", wrap(buildinVectorSet)},
+                {"vector-push", wrap(buildinVectorPush)},
+                {"vector-pop", wrap(buildinVectorPop)},
+                {"hash-map", wrap(buildinHashMap)},
+                {"list->map", wrap(buildinListToMap)},
+                {"map->list", wrap(buildinMapToList)},
+                {"map-count", wrap(buildinMapCount)},
+                {"map-ref", wrap(buildinMapRef)},
+                {"map-set", wrap(buildinMapSet)},
+                {"map-remove", wrap(buildinMapRemove)},
+
+                {"define-syntax", buildinDefineSyntax},
+                {"defmacro", buildinDefmacro},
+                {"gensym", wrap(buildinGensym)},
             }
         );
 
-        env.vars.insert(
+        // derived forms, expanded into the primary ones at their first evaluation
+        env.embeds.insert(
             {
-                {"true", true},
-                {"false", false},
-                {"cons", buildinCons},
-                {"car", buildinCar},
-                {"cdr", buildinCdr}
+                {"let*", makeSyntaxRules("let*",
+                    "(syntax-rules () ((_ body) body) ((_ (v e) rest ... body) (let (v e) (let* rest ... body))))")},
+                {"when", makeSyntaxRules("when",
+                    "(syntax-rules () ((_ c body ...) (if c (begin body ...) false)))")},
+                {"unless", makeSyntaxRules("unless",
+                    "(syntax-rules () ((_ c body ...) (if c false (begin body ...))))")},
             }
         );
+
+#ifndef _WIN32
+        env.embeds.insert(
+            {
+                {"spawn", wrap(buildinSpawn)},
+                {"yield", wrap(buildinYield)},
+                {"join", wrap(buildinJoin)},
+                {"chan", wrap(buildinChan)},
+                {"send", wrap(buildinSend)},
+                {"recv", wrap(buildinRecv)},
+                {"shard-map", wrap(buildinShardMap)},
+                {"load-native", wrap(buildinLoadNative)},
+            }
+        );
+#endif
+
+        env.extend("true", true);
+        env.extend("false", false);
+        env.extend("stream-null", List());
     }
 }
\ No newline at end of file
@@ -1,14 +1,133 @@
 #include "lispbase.h"
+#include "macro.h"
+#include <algorithm>
+#include <cstdint>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
 
 namespace lisp
 {
+    Meter::Meter(const Budget &_limit) : prev(current), limit(_limit)
+    {
+        current = this;
+    }
+
+    Meter::~Meter()
+    {
+        current = prev;
+
+        if(ending){
+            ending(this);
+        }
+    }
+
+    bool Meter::exceed(const char *_reason)
+    {
+        if(!reason){
+            reason = _reason;
+            std::cerr << "budget: " << _reason << " limit exceeded" << std::endl;
+        }
+
+        return false;
+    }
+
+    bool Meter::consume(std::size_t _steps, std::size_t _fuel, std::size_t _heap)
+    {
+        bool ok = true;
+
+        for(auto m = this; m != nullptr; m = m->prev){
+            m->used.steps += _steps;
+            m->used.fuel += _fuel;
+            m->used.heap += _heap;
+
+            if(m->reason){
+                ok = false;
+            }
+            else if(m->limit.steps && m->used.steps > m->limit.steps){
+                ok = m->exceed("step");
+            }
+            else if(m->limit.fuel && m->used.fuel > m->limit.fuel){
+                ok = m->exceed("fuel");
+            }
+            else if(m->limit.heap && m->used.heap > m->limit.heap){
+                ok = m->exceed("heap");
+            }
+        }
+
+        return ok;
+    }
+
+    bool Meter::push()
+    {
+        bool ok = true;
+
+        for(auto m = this; m != nullptr; m = m->prev){
+            m->level++;
+            m->used.depth = std::max(m->used.depth, m->level);
+
+            if(m->reason){
+                ok = false;
+            }
+            else if(m->limit.depth && m->level > m->limit.depth){
+                ok = m->exceed("depth");
+            }
+        }
+
+        return ok;
+    }
+
+    void Meter::pop()
+    {
+        for(auto m = this; m != nullptr; m = m->prev){
+            m->level--;
+        }
+    }
+
+    void limitStack()
+    {
+#ifndef _WIN32
+        // left for what runs without checks, like printing a failure
+        static const std::size_t margin = 256 << 10;
+
+        std::size_t size = 8 << 20;
+        rlimit limit;
+        if(getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY){
+            size = limit.rlim_cur;
+        }
+
+        // the caller is near the top of its stack, what lies above fits in the margin
+        char here;
+        auto top = reinterpret_cast<std::uintptr_t>(&here);
+        if(size > 2 * margin && top > size){
+            stackLimit = reinterpret_cast<const char *>(top - size + margin);
+        }
+#endif
+    }
+
+    std::optional<Cell> evaluate(const Cell &_expr, PtrEnvir &_envir, const Budget &_budget)
+    {
+        Meter meter(_budget);
+        return evaluate(_expr, _envir);
+    }
+
     std::optional<Cell> evaluate(const Cell &_expr, PtrEnvir &_envir)
     {
+        if(!Meter::step()){
+            return std::nullopt;
+        }
+
         if(_expr.isType<std::string>()){
-            auto name = _expr.get<std::string>();
+            auto &name = _expr.ref<std::string>();
             auto var = _envir->lookupVars(name);
             if(var){
-                return evaluate(var.value(), _envir);
+                // a name bound to a name, like (define f +), is looked up again
+                if(var->isType<std::string>()){
+                    return evaluate(*var, _envir);
+                }
+
+                return *var;
             }
 
             auto embed = _envir->lookupEmbeds(name);
@@ -16,36 +135,49 @@ namespace lisp
                 return name;
             }
 
+            // keywords, like :workers, evaluate to themselves
+            if(name.front() == ':'){
+                return Quotation(name);
+            }
+
             std::cerr << "eval: undefined indentifier '" << name << '\''<< std::endl;
             return std::nullopt;
         }
 
         if(_expr.isType<List>()){
-            auto list = _expr.get<List>();
+            auto &list = _expr.ref<List>();
 
             if(list.empty()){
                 std::cerr << "eval: empty list" << std::endl;
                 return std::nullopt;
             }
 
-            auto operat = list.front();
-            list.pop_front();
-            return apply(operat, list, _envir);
+            return apply(list.front(), Args(list).tail(), _envir, &_expr);
         }
 
         return _expr;
     }
 
-    std::optional<Cell> apply(const Cell &_operat, const List &_operands, PtrEnvir &_envir)
+    std::optional<Cell> apply(const Cell &_operat, Args _operands, PtrEnvir &_envir, const Cell *_form)
     {
+        struct Depth{
+            const bool ok = Meter::enter() && stackLeft();
+            ~Depth() {Meter::leave();}
+        } depth;
+
+        if(!depth.ok || !Meter::fuel(_operands.size())){
+            return std::nullopt;
+        }
+
         auto cell = evaluate(_operat, _envir);
         if(!cell){
             return std::nullopt;
         }
 
-        auto operat = cell.value();
+        auto &operat = cell.value();
 
         if(operat.isType<PtrProc>()){
+            // keeps the procedure alive while it runs
             auto ptr = operat.get<PtrProc>();
 
             if(!ptr){
@@ -62,10 +194,19 @@ namespace lisp
             return std::nullopt;
         }
 
-        auto operName = operat.get<std::string>();
-        auto embed = _envir->lookupEmbeds(operName);
+        auto embed = _envir->lookupEmbeds(operat.ref<std::string>());
         if(embed){
-            return embed.value()(_operands, _envir);
+            // a macro use is replaced by its expansion, later evaluations of the form skip the macro
+            if(_form && embed->target<Macro>()){
+                auto &form = const_cast<Cell &>(*_form);
+                if(!expandForm(form, _envir)){
+                    return std::nullopt;
+                }
+
+                return evaluate(form, _envir);
+            }
+
+            return (*embed)(_operands, _envir);
         }
 
         // auto var = _envir.lookupVar(operName);
@@ -76,4 +217,51 @@ namespace lisp
         std::cerr << "apply: cannot apply operator" << std::endl;
         return std::nullopt;
     }
-}
\ No newline at end of file
+
+    std::optional<Cell> applyValues(const Cell &_operat, std::vector<Cell> &_values, PtrEnvir &_envir)
+    {
+        struct Depth{
+            const bool ok = Meter::enter() && stackLeft();
+            ~Depth() {Meter::leave();}
+        } depth;
+
+        if(!depth.ok || !Meter::fuel(_values.size())){
+            return std::nullopt;
+        }
+
+        if(_operat.isType<PtrProc>()){
+            auto ptr = _operat.get<PtrProc>();
+
+            if(!ptr){
+                std::cerr << "apply: null procedure" << std::endl;
+                return std::nullopt;
+            }
+
+            return ptr->invoke(_values);
+        }
+
+        if(!_operat.isType<std::string>()){
+            std::cerr << "apply: invalid operator" << std::endl;
+            return std::nullopt;
+        }
+
+        auto embed = _envir->lookupEmbeds(_operat.ref<std::string>());
+        if(!embed){
+            std::cerr << "apply: cannot apply operator" << std::endl;
+            return std::nullopt;
+        }
+
+        // embeds take operands, values that do not evaluate to themselves get quoted
+        List operands;
+        for(auto &value : _values){
+            if(value.isType<List>() || value.isType<std::string>()){
+                operands.push_back(List{std::string("quote"), std::move(value)});
+            }
+            else{
+                operands.push_back(std::move(value));
+            }
+        }
+
+        return (*embed)(operands, _envir);
+    }
+}
@@ -0,0 +1,330 @@
+#ifndef _WIN32
+#include "lisp.h"
+#include "green.h"
+#include <algorithm>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace lisp
+{
+    Task::~Task()
+    {
+        if(stack){
+            munmap(stack, stackSize);
+        }
+    }
+
+    Scheduler &Scheduler::local()
+    {
+        static thread_local Scheduler scheduler;
+        return scheduler;
+    }
+
+    void Scheduler::entry()
+    {
+        auto &scheduler = local();
+        auto task = scheduler.current.get();
+
+        {
+            std::vector<Cell> none;
+            task->result = applyValues(task->proc, none, task->envir);
+        }
+
+        task->done = true;
+        task->envir = nullptr;
+        // returns to main through uc_link
+    }
+
+    PtrTask Scheduler::spawn(const Cell &_proc, const PtrEnvir &_envir)
+    {
+        auto task = std::make_shared<Task>(_proc, _envir);
+
+        auto stack = mmap(nullptr, stackSize, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if(stack == MAP_FAILED){
+            std::cerr << "spawn: cannot map a stack" << std::endl;
+            return nullptr;
+        }
+
+        task->stack = static_cast<char *>(stack);
+        task->stackSize = stackSize;
+
+        // an overflow faults on the guard page instead of writing over another stack
+        mprotect(task->stack, sysconf(_SC_PAGESIZE), PROT_NONE);
+
+        task->meter = Meter::current;
+        if(task->meter){
+            Meter::ending = detach;
+            metered.push_back(task);
+        }
+
+        getcontext(&task->context);
+        task->context.uc_stack.ss_sp = task->stack;
+        task->context.uc_stack.ss_size = stackSize;
+        task->context.uc_link = &main;
+        makecontext(&task->context, entry, 0);
+
+        if(spawned.size() >= sweepAt){
+            spawned.erase(std::remove_if(spawned.begin(), spawned.end(), [](const std::weak_ptr<Task> &_task)
+                {
+                    auto task = _task.lock();
+                    return !task || task->done;
+                }
+            ), spawned.end());
+            sweepAt = std::max<std::size_t>(64, 2 * spawned.size());
+        }
+        spawned.push_back(task);
+
+        ready.push_back(task);
+        return task;
+    }
+
+    void Scheduler::detach(Meter *_meter)
+    {
+        auto &tasks = local().metered;
+
+        tasks.erase(std::remove_if(tasks.begin(), tasks.end(), [](const std::weak_ptr<Task> &_task)
+            {
+                auto task = _task.lock();
+                return !task || task->done;
+            }
+        ), tasks.end());
+
+        for(auto &weak : tasks){
+            auto task = weak.lock();
+
+            if(task->meter == _meter){
+                task->meter = _meter->prev;
+            }
+
+            // a meter the task made itself, while suspended, may be nested in the ending one
+            for(auto m = task->meter; m != nullptr; m = m->prev){
+                if(m->prev == _meter){
+                    m->prev = _meter->prev;
+                }
+            }
+        }
+    }
+
+    bool Scheduler::runOne()
+    {
+        if(ready.empty()){
+            return false;
+        }
+
+        current = std::move(ready.front());
+        ready.pop_front();
+
+        // a cancelled task may also have been woken, it finished on its first turn
+        if(current->done){
+            current = nullptr;
+            return true;
+        }
+
+        auto meter = Meter::swap(current->meter);
+        auto limit = stackLimit;
+        stackLimit = current->stack + stackMargin;
+
+        swapcontext(&main, &current->context);
+
+        stackLimit = limit;
+        current->meter = Meter::swap(meter);
+
+        auto task = std::move(current);
+        if(task->done){
+            wakeAll(task->joiners);
+        }
+
+        return true;
+    }
+
+    void Scheduler::suspend()
+    {
+        swapcontext(&current->context, &main);
+    }
+
+    void Scheduler::yield()
+    {
+        if(current){
+            ready.push_back(current);
+            suspend();
+            return;
+        }
+
+        for(auto n = ready.size(); n > 0 && runOne(); n--);
+    }
+
+    bool Scheduler::waitUntil(const std::function<bool ()> &_ready, Waiters &_waiters)
+    {
+        while(!_ready()){
+            if(current){
+                if(current->cancelled){
+                    return false;
+                }
+
+                _waiters.push_back(current);
+                suspend();
+
+                // resumed by cancelBlocked rather than a wake, so maybe still waiting in _waiters
+                if(current->cancelled){
+                    auto it = std::find(_waiters.begin(), _waiters.end(), current);
+                    if(it != _waiters.end()){
+                        _waiters.erase(it);
+                    }
+                    return false;
+                }
+            }
+            else if(!runOne()){
+                std::cerr << "scheduler: deadlock, no task can run" << std::endl;
+                cancelBlocked();
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // nothing is ready and the thread's code is not running a task, so each unfinished task waits
+    void Scheduler::cancelBlocked()
+    {
+        auto tasks = std::move(spawned);
+        spawned.clear();
+
+        for(auto &weak : tasks){
+            auto task = weak.lock();
+            if(task && !task->done){
+                task->cancelled = true;
+                ready.push_back(std::move(task));
+            }
+        }
+
+        while(runOne());
+    }
+
+    void Scheduler::wakeOne(Waiters &_waiters)
+    {
+        if(!_waiters.empty()){
+            ready.push_back(std::move(_waiters.front()));
+            _waiters.pop_front();
+        }
+    }
+
+    void Scheduler::wakeAll(Waiters &_waiters)
+    {
+        while(!_waiters.empty()){
+            wakeOne(_waiters);
+        }
+    }
+
+    template<typename T>
+    static T *objectOf(const Cell &_cell, const char *_name, const char *_type)
+    {
+        if(_cell.isType<PtrObject>()){
+            if(auto object = dynamic_cast<T *>(_cell.ref<PtrObject>().get())){
+                return object;
+            }
+        }
+
+        std::cerr << _name << ": need a " << _type << std::endl;
+        return nullptr;
+    }
+
+    // (spawn <procedure>) => a task, run when the spawning code waits or yields
+    std::optional<Cell> buildinSpawn(Args _args, PtrEnvir &_envir)
+    {
+        if(_args.size() != 1 || !_args.front().isType<PtrProc>()){
+            std::cerr << "spawn: need a procedure" << std::endl;
+            return std::nullopt;
+        }
+
+        auto task = Scheduler::local().spawn(_args.front(), _envir);
+        if(!task){
+            return std::nullopt;
+        }
+
+        return Cell(PtrObject(task));
+    }
+
+    std::optional<Cell> buildinYield(Args _args, PtrEnvir &)
+    {
+        if(!_args.empty()){
+            std::cerr << "yield: need no args" << std::endl;
+            return std::nullopt;
+        }
+
+        Scheduler::local().yield();
+        return true;
+    }
+
+    // (join <task>) => its value, once it finished
+    std::optional<Cell> buildinJoin(Args _args, PtrEnvir &)
+    {
+        auto task = _args.size() == 1 ? objectOf<Task>(_args.front(), "join", "task") : nullptr;
+        if(!task){
+            return std::nullopt;
+        }
+
+        if(!Scheduler::local().waitUntil([task](){return task->finished();}, task->joiners)){
+            return std::nullopt;
+        }
+
+        return task->value();
+    }
+
+    // (chan [<capacity>]), holding 1 value unless told otherwise
+    std::optional<Cell> buildinChan(Args _args, PtrEnvir &)
+    {
+        Int capacity = 1;
+        if(_args.size() == 1 && _args.front().isType<Int>()){
+            capacity = _args.front().get<Int>();
+        }
+        else if(!_args.empty()){
+            capacity = 0;
+        }
+
+        if(capacity < 1){
+            std::cerr << "chan: need a positive capacity" << std::endl;
+            return std::nullopt;
+        }
+
+        return Cell(PtrObject(std::make_shared<Channel>(capacity)));
+    }
+
+    // (send <channel> <value>) waits while the channel is full
+    std::optional<Cell> buildinSend(Args _args, PtrEnvir &)
+    {
+        auto channel = _args.size() == 2 ? objectOf<Channel>(_args.front(), "send", "channel") : nullptr;
+        if(!channel){
+            return std::nullopt;
+        }
+
+        auto &scheduler = Scheduler::local();
+        if(!scheduler.waitUntil([channel](){return channel->items.size() < channel->capacity;}, channel->senders)){
+            return std::nullopt;
+        }
+
+        channel->items.push_back(_args.back());
+        scheduler.wakeOne(channel->receivers);
+        return true;
+    }
+
+    // (recv <channel>) waits while the channel is empty
+    std::optional<Cell> buildinRecv(Args _args, PtrEnvir &)
+    {
+        auto channel = _args.size() == 1 ? objectOf<Channel>(_args.front(), "recv", "channel") : nullptr;
+        if(!channel){
+            return std::nullopt;
+        }
+
+        auto &scheduler = Scheduler::local();
+        if(!scheduler.waitUntil([channel](){return !channel->items.empty();}, channel->receivers)){
+            return std::nullopt;
+        }
+
+        auto value = std::move(channel->items.front());
+        channel->items.pop_front();
+        scheduler.wakeOne(channel->senders);
+        return value;
+    }
+}
+#endif
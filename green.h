@@ -0,0 +1,99 @@
+#pragma once
+#include "lispbase.h"
+
+#ifndef _WIN32
+#include <deque>
+#include <vector>
+#include <ucontext.h>
+
+namespace lisp
+{
+    class Task;
+    using PtrTask = std::shared_ptr<Task>;
+    using Waiters = std::deque<PtrTask>;
+
+    // A green thread running a procedure of no args on its own stack.
+    // Stacks are mapped without reserving memory, so a task holds only the pages it touched.
+    // A task is charged to the meter it was spawned under, and to the enclosing one once that ends.
+    class Task : public Object{
+        private:
+            friend class Scheduler;
+
+            ucontext_t context;
+            char *stack = nullptr;
+            std::size_t stackSize = 0;
+            Cell proc;
+            PtrEnvir envir;
+            std::optional<Cell> result;
+            bool done = false;
+            // every wait fails, so the procedure unwinds
+            bool cancelled = false;
+            Meter *meter = nullptr;
+
+        public:
+            Waiters joiners;
+
+            Task(const Cell &_proc, const PtrEnvir &_envir) : proc(_proc), envir(_envir) {}
+            ~Task();
+            Task(const Task &) = delete;
+            Task &operator=(const Task &) = delete;
+
+            const char *typeName() const override {return "Task";}
+            bool finished() const {return done;}
+            // std::nullopt if the procedure failed
+            const std::optional<Cell> &value() const {return result;}
+    };
+
+    // Runs the tasks of one OS thread cooperatively, tasks never move between threads.
+    // The thread's own code is not a task: when it waits, it runs ready tasks until
+    // what it waits for has happened, or fails once nothing is left to run. Then every blocked
+    // task is cancelled and run until it unwound, so its frames release what they hold.
+    // A task still blocked when its last reference goes otherwise is dropped without unwinding,
+    // and the cells and frames on its stack leak.
+    class Scheduler{
+        private:
+            Waiters ready;
+            PtrTask current;
+            ucontext_t main;
+            // tasks that charge a meter, which may end before they do
+            std::vector<std::weak_ptr<Task>> metered;
+            // every task spawned, swept of finished ones as it grows
+            std::vector<std::weak_ptr<Task>> spawned;
+            std::size_t sweepAt = 64;
+
+            Scheduler() = default;
+            static void entry();
+            static void detach(Meter *_meter);
+            bool runOne();
+            void suspend();
+            void cancelBlocked();
+
+        public:
+            // bytes of address space per task stack, including a guard page,
+            // evaluation fails once less than stackMargin is left
+            static inline std::size_t stackSize = 1 << 20;
+            static inline std::size_t stackMargin = 64 << 10;
+
+            static Scheduler &local();
+            PtrTask spawn(const Cell &_proc, const PtrEnvir &_envir);
+            // lets every other ready task run once
+            void yield();
+            // until _ready() holds, a task waits in _waiters for a wake
+            bool waitUntil(const std::function<bool ()> &_ready, Waiters &_waiters);
+            void wakeOne(Waiters &_waiters);
+            void wakeAll(Waiters &_waiters);
+            bool inTask() const {return current != nullptr;}
+    };
+
+    // a bounded queue of values between tasks
+    class Channel : public Object{
+        public:
+            const std::size_t capacity;
+            std::deque<Cell> items;
+            Waiters senders, receivers;
+
+            explicit Channel(std::size_t _capacity) : capacity(_capacity) {}
+            const char *typeName() const override {return "Channel";}
+    };
+}
+#endif
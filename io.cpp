@@ -0,0 +1,249 @@
+#include "lisp.h"
+#include <cstdio>
+#include <fstream>
+
+namespace lisp
+{
+    std::optional<std::string> pathOf(const Cell &_cell)
+    {
+        if(_cell.isType<String>()){
+            return _cell.ref<String>().str();
+        }
+
+        if(_cell.isType<Quotation>()){
+            return _cell.ref<Quotation>().str();
+        }
+
+        return std::nullopt;
+    }
+
+    static constexpr std::size_t bufferSize = 1 << 16;
+
+    // (read-file <path>) => the whole file as one string
+    std::optional<Cell> buildinReadFile(Args _args, PtrEnvir &)
+    {
+        auto path = _args.size() == 1 ? pathOf(_args.front()) : std::nullopt;
+        if(!path){
+            std::cerr << "read-file: need a path" << std::endl;
+            return std::nullopt;
+        }
+
+        auto file = std::fopen(path.value().c_str(), "rb");
+        if(!file){
+            std::cerr << "read-file: cannot open " << path.value() << std::endl;
+            return std::nullopt;
+        }
+
+        std::string text;
+        if(std::fseek(file, 0, SEEK_END) == 0){
+            auto size = std::ftell(file);
+            if(size > 0){
+                text.reserve(size);
+            }
+            std::fseek(file, 0, SEEK_SET);
+        }
+
+        std::vector<char> buffer(bufferSize);
+        std::size_t n;
+        while((n = std::fread(buffer.data(), 1, buffer.size(), file)) > 0){
+            text.append(buffer.data(), n);
+        }
+
+        bool failed = std::ferror(file);
+        std::fclose(file);
+
+        if(failed){
+            std::cerr << "read-file: cannot read " << path.value() << std::endl;
+            return std::nullopt;
+        }
+
+        return String(std::move(text));
+    }
+
+    // an open file shared by the promises of a line stream
+    struct LineSource{
+        std::vector<char> buffer;
+        std::ifstream in;
+
+        explicit LineSource(const std::string &_path) : buffer(bufferSize)
+        {
+            in.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+            in.open(_path, std::ios::binary);
+        }
+    };
+
+    static Cell nextLine(const std::shared_ptr<LineSource> &_source)
+    {
+        std::string line;
+        if(!std::getline(_source->in, line)){
+            return List();
+        }
+
+        if(!line.empty() && line.back() == '\r'){
+            line.pop_back();
+        }
+
+        return List{
+            String(std::move(line)),
+            std::make_shared<Promise>(
+                [source = _source]() -> std::optional<Cell>
+                {
+                    return nextLine(source);
+                }
+            )
+        };
+    }
+
+    // (file-lines <path>) => a stream of the lines, read as the stream is forced
+    std::optional<Cell> buildinFileLines(Args _args, PtrEnvir &)
+    {
+        auto path = _args.size() == 1 ? pathOf(_args.front()) : std::nullopt;
+        if(!path){
+            std::cerr << "file-lines: need a path" << std::endl;
+            return std::nullopt;
+        }
+
+        auto source = std::make_shared<LineSource>(path.value());
+        if(!source->in.is_open()){
+            std::cerr << "file-lines: cannot open " << path.value() << std::endl;
+            return std::nullopt;
+        }
+
+        return nextLine(source);
+    }
+
+    // Collects writes in a large buffer and hands them to the file in one call when it fills.
+    class Writer : public Object{
+        private:
+            static constexpr std::size_t capacity = 1 << 20;
+
+            std::FILE *file;
+            std::string buffer;
+
+        public:
+            explicit Writer(const std::string &_path) : file(std::fopen(_path.c_str(), "wb"))
+            {
+                buffer.reserve(capacity);
+            }
+
+            ~Writer() {close();}
+
+            const char *typeName() const override {return "Writer";}
+            bool good() const {return file;}
+
+            bool write(const std::string &_text)
+            {
+                if(!file){
+                    return false;
+                }
+
+                if(buffer.size() + _text.size() > capacity && !flush()){
+                    return false;
+                }
+
+                if(_text.size() > capacity){
+                    return std::fwrite(_text.data(), 1, _text.size(), file) == _text.size();
+                }
+
+                buffer += _text;
+                return true;
+            }
+
+            bool flush()
+            {
+                bool ok = std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+                buffer.clear();
+                return ok;
+            }
+
+            bool close()
+            {
+                if(!file){
+                    return false;
+                }
+
+                bool ok = flush();
+                ok = std::fclose(file) == 0 && ok;
+                file = nullptr;
+                return ok;
+            }
+    };
+
+    static Writer *writerOf(const Cell &_cell, const char *_name)
+    {
+        if(_cell.isType<PtrObject>()){
+            if(auto writer = dynamic_cast<Writer *>(_cell.ref<PtrObject>().get())){
+                return writer;
+            }
+        }
+
+        std::cerr << _name << ": need a writer" << std::endl;
+        return nullptr;
+    }
+
+    // (open-writer <path>) truncates the file
+    std::optional<Cell> buildinOpenWriter(Args _args, PtrEnvir &)
+    {
+        auto path = _args.size() == 1 ? pathOf(_args.front()) : std::nullopt;
+        if(!path){
+            std::cerr << "open-writer: need a path" << std::endl;
+            return std::nullopt;
+        }
+
+        auto writer = std::make_shared<Writer>(path.value());
+        if(!writer->good()){
+            std::cerr << "open-writer: cannot open " << path.value() << std::endl;
+            return std::nullopt;
+        }
+
+        return Cell(PtrObject(writer));
+    }
+
+    static std::optional<Cell> writeText(Args _args, const char *_name, bool _newline)
+    {
+        if(_args.size() != 2){
+            std::cerr << _name << ": need a writer and a string" << std::endl;
+            return std::nullopt;
+        }
+
+        auto writer = writerOf(_args.front(), _name);
+        if(!writer || !_args.back().isType<String>()){
+            return std::nullopt;
+        }
+
+        if(!(writer->write(_args.back().ref<String>().str()) && (!_newline || writer->write("\n")))){
+            std::cerr << _name << ": write failed" << std::endl;
+            return std::nullopt;
+        }
+
+        return true;
+    }
+
+    // (write-string <writer> <string>)
+    std::optional<Cell> buildinWriteString(Args _args, PtrEnvir &)
+    {
+        return writeText(_args, "write-string", false);
+    }
+
+    // (write-line <writer> <string>) adds a newline
+    std::optional<Cell> buildinWriteLine(Args _args, PtrEnvir &)
+    {
+        return writeText(_args, "write-line", true);
+    }
+
+    // (close-writer <writer>) flushes, a writer no longer referenced is closed as well
+    std::optional<Cell> buildinCloseWriter(Args _args, PtrEnvir &)
+    {
+        auto writer = _args.size() == 1 ? writerOf(_args.front(), "close-writer") : nullptr;
+        if(!writer){
+            return std::nullopt;
+        }
+
+        if(!writer->close()){
+            std::cerr << "close-writer: write failed" << std::endl;
+            return std::nullopt;
+        }
+
+        return true;
+    }
+}
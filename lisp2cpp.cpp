@@ -0,0 +1,1284 @@
+#include "lisp.h"
+#include "macro.h"
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// lisp2cpp <module.lisp> <out.cpp> compiles a module into the source of a native module, see native.h.
+//
+// A top-level (define <name> (lambda (<param> ...) <body>)) is compiled when its body, after macro
+// expansion, only uses numbers, booleans, if, cond, let, begin, arithmetic, comparisons, logic and
+// calls to functions of the module. Each compiled function gets
+//   - a generic version over Cells, leaving every primitive to the interpreter's own embeds,
+//   - versions specialized on fixnum, double and bool operands, running native arithmetic,
+// and a primitive of its name that picks a specialized version by the types of its operands.
+// A specialized version gives up when a fixnum overflows or a division fails, the call is then
+// redone by the generic version, so results are the interpreter's. Compiled bodies have no side
+// effects, redoing them is safe. Everything else in the module is evaluated when it is loaded,
+// interpreted functions are registered as primitives too.
+namespace
+{
+    enum class Type{None, Bool, Int, Double};
+
+    // a top-level form and its text, kept for the forms evaluated at load time
+    struct Form{
+        std::string text;
+        lisp::Cell cell;
+    };
+
+    struct Function{
+        std::string name;
+        std::vector<std::string> params;
+        lisp::Cell body = false;    // macros expanded
+        bool compiled = true;
+    };
+
+    // a version of a compiled function for fixed operand types
+    struct Spec{
+        std::vector<Type> params;
+        Type result = Type::None;
+        bool valid = true;
+    };
+
+    using SpecKey = std::pair<std::string, std::vector<Type>>;
+    using TypeScope = std::map<std::string, Type>;
+    // lisp name to C++ name, and its type in specialized versions
+    using FastScope = std::map<std::string, std::pair<std::string, Type>>;
+    using CellScope = std::map<std::string, std::string>;
+
+    const std::set<std::string> primitives = {"+", "-", "*", "/", "mod", "=", "<", ">", "<=", ">=", "not", "and", "or"};
+
+    bool isForm(const lisp::Cell &_cell, const char *_name)
+    {
+        if(!_cell.isType<lisp::List>() || _cell.ref<lisp::List>().empty()){
+            return false;
+        }
+
+        auto &head = _cell.ref<lisp::List>().front();
+        return head.isType<std::string>() && head.ref<std::string>() == _name;
+    }
+
+    const lisp::Cell &nth(const lisp::List &_list, std::size_t _i)
+    {
+        return *std::next(_list.begin(), _i);
+    }
+
+    // lisp names to C++ identifiers, anything but letters and digits is escaped
+    std::string mangle(const std::string &_name)
+    {
+        std::string out;
+        for(unsigned char c : _name){
+            if(std::isalnum(c)){
+                out.push_back(c);
+            }
+            else{
+                char buf[4];
+                std::snprintf(buf, sizeof(buf), "_%02x", c);
+                out += buf;
+            }
+        }
+        return out;
+    }
+
+    std::string typeName(Type _type)
+    {
+        switch(_type){
+            case Type::Bool: return "bool";
+            case Type::Int: return "lisp::Int";
+            case Type::Double: return "double";
+            default: return "void";
+        }
+    }
+
+    std::string intLiteral(lisp::Int _i)
+    {
+        if(_i == std::numeric_limits<lisp::Int>::min()){
+            return "std::numeric_limits<lisp::Int>::min()";
+        }
+        return "lisp::Int(INT64_C(" + std::to_string(_i) + "))";
+    }
+
+    // exact, as hexadecimal floating literals
+    std::string doubleLiteral(double _d)
+    {
+        if(std::isinf(_d)){
+            return _d < 0 ? "(-std::numeric_limits<double>::infinity())" : "std::numeric_limits<double>::infinity()";
+        }
+
+        char buf[64];
+        std::snprintf(buf, sizeof(buf), "%a", _d);
+        return std::string("double(") + buf + ")";
+    }
+
+    // C++ source under construction, statements go to the current indentation
+    class Emitter{
+        private:
+            std::string out;
+            int depth = 0;
+            std::size_t temps = 0;
+
+        public:
+            void line(const std::string &_text) {out += (_text.empty() ? "" : std::string(4 * depth, ' ') + _text) + "\n";}
+            void open(const std::string &_text) {line(_text); depth++;}
+            void close(const std::string &_text = "}") {depth--; line(_text);}
+            std::string temp(const std::string &_hint = "t") {return _hint + std::to_string(temps++);}
+            std::string local(const std::string &_name) {return temp("v") + "_" + mangle(_name);}
+            const std::string &str() const {return out;}
+    };
+
+    class Compiler{
+        private:
+            std::string module;
+            std::vector<Form> forms;
+            std::vector<Function> functions;
+            std::map<std::string, std::size_t> byName;
+            std::map<std::string, lisp::Cell> constants;
+            std::map<SpecKey, Spec> specs;
+            std::map<std::string, std::string> names;   // operator names called through the interpreter
+
+        public:
+            explicit Compiler(std::string _module) : module(std::move(_module)) {}
+            bool read(const std::string &_text);
+            void analyze();
+            std::string emit();
+
+        private:
+            const Function *compiledFunction(const std::string &_name) const;
+            bool supported(const lisp::Cell &_expr, const std::set<std::string> &_locals) const;
+            bool supportedList(const lisp::List &_list, const std::set<std::string> &_locals) const;
+            Type typeOf(const lisp::Cell &_expr, const TypeScope &_scope, bool &_ok);
+            Type typeOfList(const lisp::List &_list, const TypeScope &_scope, bool &_ok);
+            Type typeOfSpec(const SpecKey &_key, bool &_ok);
+            void inferSpecs();
+
+            std::string specName(const SpecKey &_key) const;
+            std::string nameCell(const std::string &_name);
+            std::pair<std::string, Type> fastExpr(const lisp::Cell &_expr, const FastScope &_scope, Emitter &_em);
+            std::pair<std::string, Type> fastList(const lisp::List &_list, const FastScope &_scope, Emitter &_em);
+            std::string fastCond(lisp::List::const_iterator _clause, lisp::List::const_iterator _last,
+                                 const FastScope &_scope, Type _type, Emitter &_em);
+            std::string cellExpr(const lisp::Cell &_expr, const CellScope &_scope, const Function &_self, Emitter &_em);
+            std::string cellList(const lisp::List &_list, const CellScope &_scope, const Function &_self, Emitter &_em);
+            std::string cellLiteral(const lisp::Cell &_cell) const;
+            void emitFast(const SpecKey &_key, const Spec &_spec, Emitter &_em);
+            void emitGeneric(const Function &_func, Emitter &_em);
+            void emitDispatch(const Function &_func, Emitter &_em);
+    };
+
+    bool Compiler::read(const std::string &_text)
+    {
+        std::istringstream sin(_text);
+
+        while(true){
+            while(std::isspace(sin.peek())){
+                sin.get();
+            }
+            if(sin.peek() == EOF){
+                return true;
+            }
+
+            auto begin = sin.tellg();
+            auto cell = lisp::parseInput(sin);
+            if(!cell){
+                std::cerr << "lisp2cpp: parse error at offset " << begin << std::endl;
+                return false;
+            }
+
+            auto end = sin.good() ? sin.tellg() : std::streampos(_text.size());
+            sin.clear();
+            forms.push_back({_text.substr(begin, end - begin), std::move(cell.value())});
+        }
+    }
+
+    // names set! anywhere, they cannot be compiled or inlined
+    void collectAssigned(const lisp::Cell &_cell, std::set<std::string> &_names)
+    {
+        if(!_cell.isType<lisp::List>()){
+            return;
+        }
+
+        auto &list = _cell.ref<lisp::List>();
+        if(isForm(_cell, "set!") && list.size() == 3 && nth(list, 1).isType<std::string>()){
+            _names.insert(nth(list, 1).ref<std::string>());
+        }
+        for(auto &cell : list){
+            collectAssigned(cell, _names);
+        }
+    }
+
+    void Compiler::analyze()
+    {
+        auto envir = lisp::Environment::createEnvir();
+
+        std::set<std::string> assigned;
+        std::map<std::string, int> defined;
+        for(auto &form : forms){
+            collectAssigned(form.cell, assigned);
+            if(isForm(form.cell, "define") && form.cell.ref<lisp::List>().size() == 3
+                && nth(form.cell.ref<lisp::List>(), 1).isType<std::string>()){
+                defined[nth(form.cell.ref<lisp::List>(), 1).ref<std::string>()]++;
+            }
+        }
+
+        for(auto &form : forms){
+            // macros of the module expand the forms after them
+            if(isForm(form.cell, "define-syntax") || isForm(form.cell, "defmacro")){
+                auto cell = form.cell;
+                lisp::evaluate(cell, envir);
+                continue;
+            }
+
+            if(!isForm(form.cell, "define") || form.cell.ref<lisp::List>().size() != 3){
+                continue;
+            }
+
+            auto &list = form.cell.ref<lisp::List>();
+            if(!nth(list, 1).isType<std::string>()){
+                continue;
+            }
+
+            auto &name = nth(list, 1).ref<std::string>();
+            if(assigned.count(name) || defined[name] > 1){
+                continue;
+            }
+
+            auto &value = list.back();
+            if(value.isType<lisp::Int>() || value.isType<double>() || value.isType<bool>()){
+                constants.emplace(name, value);
+                continue;
+            }
+
+            if(!isForm(value, "lambda") || value.ref<lisp::List>().size() != 3
+                || !nth(value.ref<lisp::List>(), 1).isType<lisp::List>()){
+                continue;
+            }
+
+            Function func;
+            func.name = name;
+
+            bool ok = true;
+            for(auto &param : nth(value.ref<lisp::List>(), 1).ref<lisp::List>()){
+                ok = ok && param.isType<std::string>();
+                if(ok){
+                    func.params.push_back(param.ref<std::string>());
+                }
+            }
+
+            auto lambda = value;
+            if(!ok || !lisp::expandAll(lambda, envir)){
+                continue;
+            }
+
+            func.body = lambda.ref<lisp::List>().back();
+            byName[name] = functions.size();
+            functions.push_back(std::move(func));
+        }
+
+        // a function calling an interpreted one is still compiled, it calls the primitive of that name
+        for(auto &func : functions){
+            std::set<std::string> locals(func.params.begin(), func.params.end());
+            func.compiled = supported(func.body, locals);
+            if(!func.compiled){
+                std::cerr << "lisp2cpp: " << func.name << " is interpreted" << std::endl;
+            }
+        }
+
+        inferSpecs();
+    }
+
+    const Function *Compiler::compiledFunction(const std::string &_name) const
+    {
+        auto it = byName.find(_name);
+        return it != byName.end() && functions[it->second].compiled ? &functions[it->second] : nullptr;
+    }
+
+    bool Compiler::supported(const lisp::Cell &_expr, const std::set<std::string> &_locals) const
+    {
+        if(_expr.isType<lisp::Int>() || _expr.isType<double>() || _expr.isType<lisp::BigInt>() || _expr.isType<bool>()){
+            return true;
+        }
+
+        if(_expr.isType<std::string>()){
+            auto &name = _expr.ref<std::string>();
+            return _locals.count(name) || name == "true" || name == "false" || constants.count(name);
+        }
+
+        if(_expr.isType<lisp::List>() && !_expr.ref<lisp::List>().empty()){
+            return supportedList(_expr.ref<lisp::List>(), _locals);
+        }
+
+        return false;
+    }
+
+    bool Compiler::supportedList(const lisp::List &_list, const std::set<std::string> &_locals) const
+    {
+        auto &head = _list.front();
+        if(!head.isType<std::string>() || _locals.count(head.ref<std::string>())){
+            return false;
+        }
+
+        auto &name = head.ref<std::string>();
+        auto all = [&](lisp::List::const_iterator _first, lisp::List::const_iterator _last,
+                       const std::set<std::string> &_scope)
+            {
+                for(; _first != _last; _first++){
+                    if(!supported(*_first, _scope)){
+                        return false;
+                    }
+                }
+                return true;
+            };
+
+        if(byName.count(name) || primitives.count(name)){
+            return all(std::next(_list.begin()), _list.end(), _locals);
+        }
+
+        if(name == "if"){
+            return _list.size() == 4 && all(std::next(_list.begin()), _list.end(), _locals);
+        }
+
+        if(name == "begin"){
+            return _list.size() >= 2 && all(std::next(_list.begin()), _list.end(), _locals);
+        }
+
+        // (cond (<cond> <expr>) ... <default>)
+        if(name == "cond"){
+            if(_list.size() < 3){
+                return false;
+            }
+
+            auto last = std::prev(_list.end());
+            for(auto it = std::next(_list.begin()); it != last; it++){
+                if(!it->isType<lisp::List>() || it->ref<lisp::List>().size() != 2
+                    || !all(it->ref<lisp::List>().begin(), it->ref<lisp::List>().end(), _locals)){
+                    return false;
+                }
+            }
+            return supported(*last, _locals);
+        }
+
+        // (let (<var> <expr>) ... <body>), named lets stay interpreted
+        if(name == "let"){
+            if(_list.size() < 3){
+                return false;
+            }
+
+            auto scope = _locals;
+            auto last = std::prev(_list.end());
+            for(auto it = std::next(_list.begin()); it != last; it++){
+                if(!it->isType<lisp::List>() || it->ref<lisp::List>().size() != 2
+                    || !it->ref<lisp::List>().front().isType<std::string>()
+                    || !supported(it->ref<lisp::List>().back(), _locals)){
+                    return false;
+                }
+                scope.insert(it->ref<lisp::List>().front().ref<std::string>());
+            }
+            return supported(*last, scope);
+        }
+
+        return false;
+    }
+
+    // None is the type of calls whose result is not inferred yet, it joins with anything
+    bool join(Type &_acc, Type _type)
+    {
+        if(_type == Type::None){
+            return true;
+        }
+        if(_acc == Type::None){
+            _acc = _type;
+            return true;
+        }
+        return _acc == _type;
+    }
+
+    Type Compiler::typeOf(const lisp::Cell &_expr, const TypeScope &_scope, bool &_ok)
+    {
+        if(_expr.isType<lisp::Int>()){
+            return Type::Int;
+        }
+        if(_expr.isType<double>()){
+            return Type::Double;
+        }
+        if(_expr.isType<bool>()){
+            return Type::Bool;
+        }
+
+        if(_expr.isType<std::string>()){
+            auto &name = _expr.ref<std::string>();
+            auto local = _scope.find(name);
+            if(local != _scope.end()){
+                return local->second;
+            }
+            if(name == "true" || name == "false"){
+                return Type::Bool;
+            }
+
+            auto constant = constants.find(name);
+            if(constant != constants.end()){
+                return typeOf(constant->second, _scope, _ok);
+            }
+        }
+
+        if(_expr.isType<lisp::List>()){
+            return typeOfList(_expr.ref<lisp::List>(), _scope, _ok);
+        }
+
+        // bignum literals and the like only have the generic version
+        _ok = false;
+        return Type::None;
+    }
+
+    Type Compiler::typeOfList(const lisp::List &_list, const TypeScope &_scope, bool &_ok)
+    {
+        auto &name = _list.front().ref<std::string>();
+        auto args = _list.size() - 1;
+
+        std::vector<Type> types;
+        auto operands = [&]()
+            {
+                for(auto it = std::next(_list.begin()); it != _list.end(); it++){
+                    types.push_back(typeOf(*it, _scope, _ok));
+                }
+            };
+
+        auto fail = [&]()
+            {
+                _ok = false;
+                return Type::None;
+            };
+
+        // operands of one type, out of the allowed ones
+        auto same = [&](std::initializer_list<Type> _allowed)
+            {
+                Type acc = Type::None;
+                for(auto type : types){
+                    if(!join(acc, type)){
+                        return fail();
+                    }
+                }
+                if(acc != Type::None && std::find(_allowed.begin(), _allowed.end(), acc) == _allowed.end()){
+                    return fail();
+                }
+                return acc;
+            };
+
+        if(auto func = compiledFunction(name)){
+            operands();
+            if(types.size() != func->params.size()){
+                return fail();
+            }
+            if(std::find(types.begin(), types.end(), Type::None) != types.end()){
+                return Type::None;
+            }
+            return typeOfSpec({name, types}, _ok);
+        }
+
+        if(byName.count(name)){
+            return fail();
+        }
+
+        if(name == "+" || name == "*"){
+            operands();
+            return args >= 2 ? same({Type::Int, Type::Double}) : fail();
+        }
+        if(name == "-"){
+            operands();
+            return args == 1 || args == 2 ? same({Type::Int, Type::Double}) : fail();
+        }
+        if(name == "/"){
+            operands();
+            return args == 2 ? same({Type::Int, Type::Double}) : fail();
+        }
+        // the result type is known whatever the operands turn out to be
+        auto fixed = [&](std::size_t _args, std::initializer_list<Type> _allowed, Type _result)
+            {
+                operands();
+                if(args != _args){
+                    return fail();
+                }
+                same(_allowed);
+                return _ok ? _result : Type::None;
+            };
+
+        if(name == "mod"){
+            return fixed(2, {Type::Int}, Type::Int);
+        }
+        if(name == "<" || name == ">" || name == "<=" || name == ">="){
+            return fixed(2, {Type::Int, Type::Double}, Type::Bool);
+        }
+        if(name == "="){
+            return fixed(2, {Type::Bool, Type::Int, Type::Double}, Type::Bool);
+        }
+        if(name == "not"){
+            return fixed(1, {Type::Bool}, Type::Bool);
+        }
+        if(name == "and" || name == "or"){
+            return fixed(2, {Type::Bool}, Type::Bool);
+        }
+
+        if(name == "if"){
+            Type cond = Type::Bool;
+            if(!join(cond, typeOf(nth(_list, 1), _scope, _ok))){
+                return fail();
+            }
+
+            Type acc = Type::None;
+            if(!join(acc, typeOf(nth(_list, 2), _scope, _ok)) || !join(acc, typeOf(nth(_list, 3), _scope, _ok))){
+                return fail();
+            }
+            return acc;
+        }
+
+        if(name == "begin"){
+            operands();
+            return types.back();
+        }
+
+        if(name == "cond"){
+            Type acc = Type::None;
+            auto last = std::prev(_list.end());
+            for(auto it = std::next(_list.begin()); it != last; it++){
+                Type cond = Type::Bool;
+                if(!join(cond, typeOf(it->ref<lisp::List>().front(), _scope, _ok))
+                    || !join(acc, typeOf(it->ref<lisp::List>().back(), _scope, _ok))){
+                    return fail();
+                }
+            }
+            if(!join(acc, typeOf(*last, _scope, _ok))){
+                return fail();
+            }
+            return acc;
+        }
+
+        if(name == "let"){
+            auto scope = _scope;
+            auto last = std::prev(_list.end());
+            for(auto it = std::next(_list.begin()); it != last; it++){
+                auto type = typeOf(it->ref<lisp::List>().back(), _scope, _ok);
+                if(type == Type::None){
+                    // a binding of unknown type would make the body unknown as well
+                    return _ok ? Type::None : fail();
+                }
+                scope[it->ref<lisp::List>().front().ref<std::string>()] = type;
+            }
+            return typeOf(*last, scope, _ok);
+        }
+
+        return fail();
+    }
+
+    // the result type of a specialized version, it is added when first called for
+    Type Compiler::typeOfSpec(const SpecKey &_key, bool &_ok)
+    {
+        auto it = specs.find(_key);
+        if(it == specs.end()){
+            it = specs.emplace(_key, Spec{_key.second}).first;
+        }
+
+        if(!it->second.valid){
+            _ok = false;
+            return Type::None;
+        }
+        return it->second.result;
+    }
+
+    // versions for every mix of operand types up to two params, one type for all of them beyond,
+    // and whatever they call, typed until nothing changes
+    void Compiler::inferSpecs()
+    {
+        const Type all[] = {Type::Int, Type::Double, Type::Bool};
+
+        for(auto &func : functions){
+            if(!func.compiled){
+                continue;
+            }
+
+            auto arity = func.params.size();
+            std::vector<std::vector<Type>> seeds;
+            if(arity <= 2){
+                seeds.push_back({});
+                for(std::size_t i = 0; i < arity; i++){
+                    std::vector<std::vector<Type>> longer;
+                    for(auto &seed : seeds){
+                        for(auto type : all){
+                            longer.push_back(seed);
+                            longer.back().push_back(type);
+                        }
+                    }
+                    seeds = std::move(longer);
+                }
+            }
+            else{
+                for(auto type : all){
+                    seeds.push_back(std::vector<Type>(arity, type));
+                }
+            }
+
+            for(auto &seed : seeds){
+                specs.emplace(SpecKey{func.name, seed}, Spec{seed});
+            }
+        }
+
+        bool changed = true;
+        while(changed){
+            changed = false;
+
+            // specs grows while bodies are typed, so keys are taken first
+            std::vector<SpecKey> keys;
+            for(auto &spec : specs){
+                keys.push_back(spec.first);
+            }
+
+            for(auto &key : keys){
+                if(!specs.at(key).valid){
+                    continue;
+                }
+
+                auto &func = functions[byName.at(key.first)];
+                TypeScope scope;
+                for(std::size_t i = 0; i < func.params.size(); i++){
+                    scope[func.params[i]] = key.second[i];
+                }
+
+                bool ok = true;
+                auto type = typeOf(func.body, scope, ok);
+
+                auto &spec = specs.at(key);
+                if(!ok || (spec.result != Type::None && type != spec.result)){
+                    spec.valid = false;
+                    changed = true;
+                }
+                else if(type != spec.result){
+                    spec.result = type;
+                    changed = true;
+                }
+            }
+
+            // results never inferred, like loops without a base case
+            if(!changed){
+                for(auto &spec : specs){
+                    if(spec.second.valid && spec.second.result == Type::None){
+                        spec.second.valid = false;
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+
+    std::string Compiler::specName(const SpecKey &_key) const
+    {
+        std::string sig;
+        for(auto type : _key.second){
+            sig.push_back(type == Type::Int ? 'i' : type == Type::Double ? 'd' : 'b');
+        }
+        return "fast_" + mangle(_key.first) + "_" + sig;
+    }
+
+    // a Cell holding an operator name, applied through the interpreter
+    std::string Compiler::nameCell(const std::string &_name)
+    {
+        auto it = names.find(_name);
+        if(it == names.end()){
+            it = names.emplace(_name, "op_" + mangle(_name)).first;
+        }
+        return it->second;
+    }
+
+    std::pair<std::string, Type> Compiler::fastExpr(const lisp::Cell &_expr, const FastScope &_scope, Emitter &_em)
+    {
+        if(_expr.isType<lisp::Int>()){
+            return {intLiteral(_expr.get<lisp::Int>()), Type::Int};
+        }
+        if(_expr.isType<double>()){
+            return {doubleLiteral(_expr.get<double>()), Type::Double};
+        }
+        if(_expr.isType<bool>()){
+            return {_expr.get<bool>() ? "true" : "false", Type::Bool};
+        }
+
+        if(_expr.isType<std::string>()){
+            auto &name = _expr.ref<std::string>();
+            auto local = _scope.find(name);
+            if(local != _scope.end()){
+                return local->second;
+            }
+            if(name == "true" || name == "false"){
+                return {name, Type::Bool};
+            }
+            return fastExpr(constants.at(name), _scope, _em);
+        }
+
+        return fastList(_expr.ref<lisp::List>(), _scope, _em);
+    }
+
+    std::pair<std::string, Type> Compiler::fastList(const lisp::List &_list, const FastScope &_scope, Emitter &_em)
+    {
+        auto &name = _list.front().ref<std::string>();
+
+        TypeScope types;
+        for(auto &local : _scope){
+            types[local.first] = local.second.second;
+        }
+        bool ok = true;
+        auto type = typeOfList(_list, types, ok);
+
+        if(name == "if"){
+            auto cond = fastExpr(nth(_list, 1), _scope, _em);
+            auto t = _em.temp();
+            _em.line(typeName(type) + " " + t + ";");
+            _em.open("if(" + cond.first + "){");
+            _em.line(t + " = " + fastExpr(nth(_list, 2), _scope, _em).first + ";");
+            _em.close();
+            _em.open("else{");
+            _em.line(t + " = " + fastExpr(nth(_list, 3), _scope, _em).first + ";");
+            _em.close();
+            return {t, type};
+        }
+
+        if(name == "cond"){
+            return {fastCond(std::next(_list.begin()), std::prev(_list.end()), _scope, type, _em), type};
+        }
+
+        if(name == "let"){
+            auto scope = _scope;
+            auto last = std::prev(_list.end());
+            for(auto it = std::next(_list.begin()); it != last; it++){
+                auto value = fastExpr(it->ref<lisp::List>().back(), _scope, _em);
+                auto &var = it->ref<lisp::List>().front().ref<std::string>();
+                auto local = _em.local(var);
+                _em.line("const " + typeName(value.second) + " " + local + " = " + value.first + ";");
+                scope[var] = {local, value.second};
+            }
+            return fastExpr(*last, scope, _em);
+        }
+
+        // operands are evaluated in order before the operation, as wrap does
+        std::vector<std::pair<std::string, Type>> args;
+        for(auto it = std::next(_list.begin()); it != _list.end(); it++){
+            args.push_back(fastExpr(*it, _scope, _em));
+        }
+
+        if(name == "begin"){
+            for(std::size_t i = 0; i + 1 < args.size(); i++){
+                _em.line("(void)" + args[i].first + ";");
+            }
+            return args.back();
+        }
+
+        if(auto func = compiledFunction(name)){
+            std::vector<Type> key;
+            std::string call;
+            for(auto &arg : args){
+                key.push_back(arg.second);
+                call += (call.empty() ? "" : ", ") + arg.first;
+            }
+
+            auto t = _em.temp();
+            _em.line("const auto " + t + " = " + specName({func->name, key}) + "(" + call + ");");
+            _em.open("if(!" + t + "){");
+            _em.line("return std::nullopt;");
+            _em.close();
+            return {"(*" + t + ")", type};
+        }
+
+        auto operand = args.front().second;
+        auto &a = args.front().first;
+        auto &b = args.back().first;
+
+        // fixnums overflow into the generic version, which makes bignums
+        if(operand == Type::Int && (name == "+" || name == "-" || name == "*")){
+            const char *builtin = name == "+" ? "__builtin_add_overflow" : name == "-" ? "__builtin_sub_overflow"
+                                                                                      : "__builtin_mul_overflow";
+            auto acc = args.size() == 1 ? "lisp::Int(0)" : a;
+            for(std::size_t i = args.size() == 1 ? 0 : 1; i < args.size(); i++){
+                auto t = _em.temp();
+                _em.line("lisp::Int " + t + ";");
+                _em.open("if(" + std::string(builtin) + "(" + acc + ", " + args[i].first + ", &" + t + ")){");
+                _em.line("return std::nullopt;");
+                _em.close();
+                acc = t;
+            }
+            return {acc, Type::Int};
+        }
+
+        // division by zero is reported by the generic version
+        if(operand == Type::Int && (name == "/" || name == "mod")){
+            auto t = _em.temp();
+            _em.open("if(" + b + " == 0 || (" + a + " == std::numeric_limits<lisp::Int>::min() && " + b + " == -1)){");
+            _em.line("return std::nullopt;");
+            _em.close();
+            _em.line("const lisp::Int " + t + " = " + a + (name == "/" ? " / " : " % ") + b + ";");
+            return {t, Type::Int};
+        }
+
+        // the interpreter folds double operands starting from the last one
+        if(operand == Type::Double && (name == "+" || name == "*")){
+            auto acc = args.back().first;
+            for(std::size_t i = 0; i + 1 < args.size(); i++){
+                acc = "(" + acc + " " + name + " " + args[i].first + ")";
+            }
+            return {acc, Type::Double};
+        }
+
+        if(name == "-" && args.size() == 1){
+            return {"(-" + a + ")", Type::Double};
+        }
+
+        static const std::map<std::string, std::string> binary = {
+            {"-", "-"}, {"/", "/"}, {"=", "=="}, {"<", "<"}, {">", ">"}, {"<=", "<="}, {">=", ">="},
+            {"and", "&&"}, {"or", "||"},
+        };
+        if(name == "not"){
+            return {"(!" + a + ")", Type::Bool};
+        }
+        return {"(" + a + " " + binary.at(name) + " " + b + ")", type};
+    }
+
+    // (cond ...) as nested ifs assigning one result
+    std::string Compiler::fastCond(lisp::List::const_iterator _clause, lisp::List::const_iterator _last,
+                                   const FastScope &_scope, Type _type, Emitter &_em)
+    {
+        auto t = _em.temp();
+        _em.line(typeName(_type) + " " + t + ";");
+
+        std::size_t nested = 0;
+        for(auto it = _clause; it != _last; it++, nested++){
+            auto cond = fastExpr(it->ref<lisp::List>().front(), _scope, _em);
+            _em.open("if(" + cond.first + "){");
+            _em.line(t + " = " + fastExpr(it->ref<lisp::List>().back(), _scope, _em).first + ";");
+            _em.close();
+            _em.open("else{");
+        }
+
+        _em.line(t + " = " + fastExpr(*_last, _scope, _em).first + ";");
+        for(; nested > 0; nested--){
+            _em.close();
+        }
+        return t;
+    }
+
+    std::string Compiler::cellLiteral(const lisp::Cell &_cell) const
+    {
+        if(_cell.isType<lisp::Int>()){
+            return "lisp::Cell(" + intLiteral(_cell.get<lisp::Int>()) + ")";
+        }
+        if(_cell.isType<double>()){
+            return "lisp::Cell(" + doubleLiteral(_cell.get<double>()) + ")";
+        }
+        if(_cell.isType<lisp::BigInt>()){
+            return "lisp::Cell(lisp::BigInt::fromString(\"" + _cell.ref<lisp::BigInt>().toString() + "\").value())";
+        }
+        return _cell.get<bool>() ? "lisp::Cell(true)" : "lisp::Cell(false)";
+    }
+
+    std::string Compiler::cellExpr(const lisp::Cell &_expr, const CellScope &_scope, const Function &_self, Emitter &_em)
+    {
+        if(_expr.isType<std::string>()){
+            auto &name = _expr.ref<std::string>();
+            auto local = _scope.find(name);
+            if(local != _scope.end()){
+                return local->second;
+            }
+            if(name == "true" || name == "false"){
+                return "lisp::Cell(" + name + ")";
+            }
+            return cellLiteral(constants.at(name));
+        }
+
+        if(_expr.isType<lisp::List>()){
+            return cellList(_expr.ref<lisp::List>(), _scope, _self, _em);
+        }
+
+        return cellLiteral(_expr);
+    }
+
+    std::string Compiler::cellList(const lisp::List &_list, const CellScope &_scope, const Function &_self, Emitter &_em)
+    {
+        auto &name = _list.front().ref<std::string>();
+
+        if(name == "if" || name == "cond"){
+            auto t = _em.temp();
+            _em.line("lisp::Cell " + t + " = false;");
+
+            // clauses as (<cond> <expr>), the default as the last one
+            std::vector<std::pair<const lisp::Cell *, const lisp::Cell *>> clauses;
+            if(name == "if"){
+                clauses.push_back({&nth(_list, 1), &nth(_list, 2)});
+                clauses.push_back({nullptr, &nth(_list, 3)});
+            }
+            else{
+                for(auto it = std::next(_list.begin()); it != std::prev(_list.end()); it++){
+                    clauses.push_back({&it->ref<lisp::List>().front(), &it->ref<lisp::List>().back()});
+                }
+                clauses.push_back({nullptr, &_list.back()});
+            }
+
+            std::size_t nested = 0;
+            for(auto &clause : clauses){
+                if(!clause.first){
+                    _em.line(t + " = " + cellExpr(*clause.second, _scope, _self, _em) + ";");
+                    break;
+                }
+
+                auto cond = _em.temp();
+                _em.line("const lisp::Cell " + cond + " = " + cellExpr(*clause.first, _scope, _self, _em) + ";");
+                _em.open("if(!" + cond + ".isType<bool>()){");
+                _em.line("std::cerr << \"" + name + ": invalid condition\" << std::endl;");
+                _em.line("return std::nullopt;");
+                _em.close();
+                _em.open("if(" + cond + ".get<bool>()){");
+                _em.line(t + " = " + cellExpr(*clause.second, _scope, _self, _em) + ";");
+                _em.close();
+                _em.open("else{");
+                nested++;
+            }
+            for(; nested > 0; nested--){
+                _em.close();
+            }
+            return t;
+        }
+
+        if(name == "let"){
+            auto scope = _scope;
+            auto last = std::prev(_list.end());
+            for(auto it = std::next(_list.begin()); it != last; it++){
+                auto value = cellExpr(it->ref<lisp::List>().back(), _scope, _self, _em);
+                auto &var = it->ref<lisp::List>().front().ref<std::string>();
+                auto local = _em.local(var);
+                _em.line("const lisp::Cell " + local + " = " + value + ";");
+                scope[var] = local;
+            }
+            return cellExpr(*last, scope, _self, _em);
+        }
+
+        std::vector<std::string> args;
+        for(auto it = std::next(_list.begin()); it != _list.end(); it++){
+            auto t = _em.temp();
+            _em.line("const lisp::Cell " + t + " = " + cellExpr(*it, _scope, _self, _em) + ";");
+            args.push_back(t);
+        }
+
+        if(name == "begin"){
+            return args.back();
+        }
+
+        auto t = _em.temp();
+        auto func = compiledFunction(name);
+        if(func && func->params.size() != args.size()){
+            _em.line("std::cerr << \"Procedure: fail to bind args\" << std::endl;");
+            _em.line("return std::nullopt;");
+            return "lisp::Cell(false)";
+        }
+
+        if(func){
+            // recursive calls stay generic, the specialized version already gave up on this call
+            std::string call;
+            for(auto &arg : args){
+                call += (call.empty() ? "" : ", ") + arg;
+            }
+            auto callee = func == &_self ? "generic_" + mangle(name) : "call_" + mangle(name);
+            _em.line("const auto " + t + " = " + callee + "(" + call + ");");
+        }
+        else{
+            // primitives and interpreted functions, through the embeds of those names
+            std::string values;
+            for(auto &arg : args){
+                values += (values.empty() ? "" : ", ") + arg;
+            }
+            _em.line("std::vector<lisp::Cell> " + t + "_values{" + values + "};");
+            _em.line("const auto " + t + " = lisp::applyValues(" + nameCell(name) + ", " + t
+                     + "_values, moduleEnvir());");
+        }
+
+        _em.open("if(!" + t + "){");
+        _em.line("return std::nullopt;");
+        _em.close();
+        return "(*" + t + ")";
+    }
+
+    void Compiler::emitFast(const SpecKey &_key, const Spec &_spec, Emitter &_em)
+    {
+        auto &func = functions[byName.at(_key.first)];
+
+        FastScope scope;
+        std::string params;
+        for(std::size_t i = 0; i < func.params.size(); i++){
+            auto local = _em.local(func.params[i]);
+            scope[func.params[i]] = {local, _spec.params[i]};
+            params += (params.empty() ? "" : ", ") + typeName(_spec.params[i]) + " " + local;
+        }
+
+        _em.line("static std::optional<" + typeName(_spec.result) + "> " + specName(_key) + "(" + params + ")");
+        _em.open("{");
+        _em.line("char here;");
+        _em.open("if(lisp::stackLimit && &here < lisp::stackLimit){");
+        _em.line("return std::nullopt;");
+        _em.close();
+        auto result = fastExpr(func.body, scope, _em);
+        _em.line("return " + result.first + ";");
+        _em.close();
+        _em.line("");
+    }
+
+    void Compiler::emitGeneric(const Function &_func, Emitter &_em)
+    {
+        CellScope scope;
+        std::string params;
+        for(auto &param : _func.params){
+            auto local = _em.local(param);
+            scope[param] = local;
+            params += (params.empty() ? "" : ", ") + std::string("const lisp::Cell &") + local;
+        }
+
+        _em.line("static std::optional<lisp::Cell> generic_" + mangle(_func.name) + "(" + params + ")");
+        _em.open("{");
+        _em.line("Depth depth;");
+        std::string fuel = _func.params.empty() ? "" : " || !lisp::Meter::fuel(" + std::to_string(_func.params.size()) + ")";
+        _em.open("if(!depth.ok || !lisp::Meter::step()" + fuel + "){");
+        _em.line("return std::nullopt;");
+        _em.close();
+        auto result = cellExpr(_func.body, scope, _func, _em);
+        _em.line("return " + result + ";");
+        _em.close();
+        _em.line("");
+    }
+
+    // the first specialized version matching the operand types, else the generic one, which
+    // is also the only one charged to a meter
+    void Compiler::emitDispatch(const Function &_func, Emitter &_em)
+    {
+        std::vector<std::string> locals;
+        std::string params, call;
+        for(auto &param : _func.params){
+            locals.push_back(_em.local(param));
+            params += (params.empty() ? "" : ", ") + std::string("const lisp::Cell &") + locals.back();
+            call += (call.empty() ? "" : ", ") + locals.back();
+        }
+
+        _em.line("static std::optional<lisp::Cell> call_" + mangle(_func.name) + "(" + params + ")");
+        _em.open("{");
+        _em.open("if(!lisp::Meter::active()){");
+        for(auto &spec : specs){
+            if(spec.first.first != _func.name || !spec.second.valid){
+                continue;
+            }
+
+            std::string test, args;
+            for(std::size_t i = 0; i < locals.size(); i++){
+                auto type = typeName(spec.second.params[i]);
+                test += (test.empty() ? "" : " && ") + locals[i] + ".isType<" + type + ">()";
+                args += (args.empty() ? "" : ", ") + locals[i] + ".get<" + type + ">()";
+            }
+
+            auto t = _em.temp("r");
+            _em.open(test.empty() ? "{" : "if(" + test + "){");
+            _em.line("const auto " + t + " = " + specName(spec.first) + "(" + args + ");");
+            _em.open("if(" + t + "){");
+            _em.line("return lisp::Cell(*" + t + ");");
+            _em.close();
+            _em.close();
+        }
+        _em.close();
+        _em.line("return generic_" + mangle(_func.name) + "(" + call + ");");
+        _em.close();
+        _em.line("");
+    }
+
+    std::string Compiler::emit()
+    {
+        Emitter body;
+
+        for(auto &spec : specs){
+            if(spec.second.valid){
+                emitFast(spec.first, spec.second, body);
+            }
+        }
+        for(auto &func : functions){
+            if(func.compiled){
+                emitGeneric(func, body);
+                emitDispatch(func, body);
+            }
+        }
+
+        Emitter out;
+        out.line("// generated by lisp2cpp from " + module + ", (load-native ...) registers its functions");
+        out.line("#include \"macro.h\"");
+        out.line("#include \"native.h\"");
+        out.line("#include <cstdint>");
+        out.line("#include <iostream>");
+        out.line("#include <limits>");
+        out.line("");
+        out.line("namespace");
+        out.open("{");
+        out.line("// the interpreted forms of the module are evaluated here");
+        out.line("lisp::PtrEnvir &moduleEnvir()");
+        out.open("{");
+        out.line("static lisp::PtrEnvir envir = lisp::Environment::createEnvir();");
+        out.line("return envir;");
+        out.close();
+        out.line("");
+        out.line("// charges a call of a generic version the way apply charges one");
+        out.open("struct Depth{");
+        out.line("const bool ok = lisp::Meter::enter() && lisp::stackLeft();");
+        out.line("~Depth() {lisp::Meter::leave();}");
+        out.close("};");
+        out.line("");
+        for(auto &name : names){
+            out.line("const lisp::Cell " + name.second + "(std::string(\"" + name.first + "\"));");
+        }
+        out.line("");
+
+        // prototypes, bodies call each other in any order
+        for(auto &spec : specs){
+            if(spec.second.valid){
+                std::string params;
+                for(auto type : spec.second.params){
+                    params += (params.empty() ? "" : ", ") + typeName(type);
+                }
+                out.line("static std::optional<" + typeName(spec.second.result) + "> " + specName(spec.first)
+                         + "(" + params + ");");
+            }
+        }
+        for(auto &func : functions){
+            if(func.compiled){
+                std::string params;
+                for(std::size_t i = 0; i < func.params.size(); i++){
+                    params += (params.empty() ? "" : ", ") + std::string("const lisp::Cell &");
+                }
+                out.line("static std::optional<lisp::Cell> generic_" + mangle(func.name) + "(" + params + ");");
+                out.line("static std::optional<lisp::Cell> call_" + mangle(func.name) + "(" + params + ");");
+            }
+        }
+        out.line("");
+
+        std::istringstream sin(body.str());
+        for(std::string line; std::getline(sin, line);){
+            out.line(line.empty() ? "" : line);
+        }
+        out.close();
+        out.line("");
+
+        // constants stay visible to the interpreted forms as well
+        std::vector<const Form *> interpreted;
+        for(auto &form : forms){
+            auto &cell = form.cell;
+            bool compiled = isForm(cell, "define") && cell.ref<lisp::List>().size() == 3
+                && nth(cell.ref<lisp::List>(), 1).isType<std::string>()
+                && compiledFunction(nth(cell.ref<lisp::List>(), 1).ref<std::string>());
+            if(!compiled){
+                interpreted.push_back(&form);
+            }
+        }
+
+        out.line("LISP_NATIVE_MODULE(_registry)");
+        out.open("{");
+        // the functions that stay interpreted are among these forms
+        if(!interpreted.empty()){
+            out.line("auto &envir = moduleEnvir();");
+        }
+        out.line("bool ok = true;");
+        out.line("");
+
+        for(auto &func : functions){
+            if(!func.compiled){
+                continue;
+            }
+
+            out.open("ok = ok && _registry->define(\"" + func.name + "\", lisp::wrap(");
+            out.line("[](lisp::Args _args, lisp::PtrEnvir &) -> std::optional<lisp::Cell>");
+            out.open("{");
+            out.open("if(_args.size() != " + std::to_string(func.params.size()) + "){");
+            out.line("std::cerr << \"Procedure: fail to bind args\" << std::endl;");
+            out.line("return std::nullopt;");
+            out.close();
+
+            std::string call;
+            if(!func.params.empty()){
+                out.line("auto it = _args.begin();");
+                for(std::size_t i = 0; i < func.params.size(); i++){
+                    out.line("auto &a" + std::to_string(i) + " = *it++;");
+                    call += (call.empty() ? "a" : ", a") + std::to_string(i);
+                }
+            }
+            out.line("return call_" + mangle(func.name) + "(" + call + ");");
+            out.close();
+            out.close("));");
+        }
+
+
+        if(!interpreted.empty()){
+            out.line("");
+            out.line("static const char *forms[] = {");
+            for(auto form : interpreted){
+                out.line("    R\"lisp(" + form->text + ")lisp\",");
+            }
+            out.line("};");
+            out.open("for(auto form : forms){");
+            out.line("auto cell = lisp::parseString(form);");
+            out.open("if(!ok || !cell || !lisp::expandAll(cell.value(), envir) || !lisp::evaluate(cell.value(), envir)){");
+            out.line("std::cerr << \"" + module + ": cannot evaluate \" << form << std::endl;");
+            out.line("return false;");
+            out.close();
+            out.close();
+        }
+
+        for(auto &func : functions){
+            if(func.compiled){
+                continue;
+            }
+
+            out.line("");
+            out.open("if(auto proc = envir->lookupVars(\"" + func.name + "\")){");
+            out.open("ok = ok && _registry->define(\"" + func.name + "\", lisp::wrap(");
+            out.line("[proc = *proc](lisp::Args _args, lisp::PtrEnvir &) -> std::optional<lisp::Cell>");
+            out.open("{");
+            out.line("std::vector<lisp::Cell> values(_args.begin(), _args.end());");
+            out.line("return lisp::applyValues(proc, values, moduleEnvir());");
+            out.close();
+            out.close("));");
+            out.close();
+        }
+
+        out.line("");
+        out.line("return ok;");
+        out.close();
+        return out.str();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc != 3){
+        std::cerr << "usage: lisp2cpp <module.lisp> <out.cpp>" << std::endl;
+        return 2;
+    }
+
+    std::ifstream fin(argv[1]);
+    if(!fin){
+        std::cerr << "lisp2cpp: cannot open " << argv[1] << std::endl;
+        return 1;
+    }
+
+    std::stringstream text;
+    text << fin.rdbuf();
+
+    lisp::Environment::initGlobalEnvir();
+
+    Compiler compiler(argv[1]);
+    if(!compiler.read(text.str())){
+        return 1;
+    }
+    compiler.analyze();
+
+    std::ofstream fout(argv[2]);
+    fout << compiler.emit();
+    return fout ? 0 : 1;
+}
@@ -1,12 +1,15 @@
 #pragma once
+#include "bigint.h"
 #include <iostream>
 #include <variant>
 #include <list>
 #include <optional>
 #include <functional>
 #include <unordered_map>
+#include <unordered_set>
 #include <sstream>
 #include <memory>
+#include <vector>
 
 namespace lisp
 {
@@ -19,62 +22,288 @@ namespace lisp
             Quotation(const std::string &_s) : value(_s) {}
             bool operator==(const Quotation &_q) const {return value == _q.value;}
             bool operator!=(const Quotation &_q) const {return value != _q.value;}
-            std::string str() const {return value;}
+            const std::string &str() const {return value;}
+    };
+    // string values, immutable text shared between copies, unlike identifiers
+    class String{
+        private:
+            std::shared_ptr<const std::string> value;
+
+        public:
+            explicit String(std::string _s) : value(std::make_shared<const std::string>(std::move(_s))) {}
+            bool operator==(const String &_s) const {return *value == *_s.value;}
+            bool operator!=(const String &_s) const {return *value != *_s.value;}
+            const std::string &str() const {return *value;}
     };
     class Procedure;
     using PtrProc = std::shared_ptr<Procedure>;
+    class Promise;
+    using PtrPromise = std::shared_ptr<Promise>;
+    // native handles exposed to lisp code, such as readers
+    class Object{
+        public:
+            virtual ~Object() = default;
+            virtual const char *typeName() const = 0;
+    };
+    using PtrObject = std::shared_ptr<Object>;
     class Cell;
+    // persistent collections, an update returns a new version sharing all untouched nodes with the old one
+    struct VectorNode;
+    using PtrVectorNode = std::shared_ptr<VectorNode>;
+    class Vector{
+        private:
+            PtrVectorNode root, tail;   // a 32-way radix tree and the last, partly filled leaf
+            std::size_t count = 0;
+            unsigned shift = 5;         // bits of the index above the leaves
+
+            std::size_t tailOffset() const {return count < 32 ? 0 : ((count - 1) >> 5) << 5;}
+            const VectorNode &leafFor(std::size_t _i) const;
+            // nodes tagged with _edit are changed in place, 0 copies every node on the way
+            void pushIn(Cell _value, std::uint64_t _edit);
+            friend class VectorBuilder;
+
+        public:
+            Vector();
+            std::size_t size() const {return count;}
+            // _i must be below size()
+            const Cell &at(std::size_t _i) const;
+            Vector set(std::size_t _i, Cell _value) const;
+            Vector push(Cell _value) const;
+            Vector pop() const;
+            bool operator==(const Vector &_v) const;
+            bool operator!=(const Vector &_v) const {return !(*this == _v);}
+    };
+    struct MapNode;
+    using PtrMapNode = std::shared_ptr<MapNode>;
+    class Map{
+        private:
+            PtrMapNode root;    // a hash array mapped trie
+            std::size_t count = 0;
+            void setIn(Cell _key, Cell _value, std::uint64_t _edit);
+            friend class MapBuilder;
+
+        public:
+            Map();
+            std::size_t size() const {return count;}
+            // nullptr when _key is absent
+            const Cell *find(const Cell &_key) const;
+            Map set(Cell _key, Cell _value) const;
+            Map remove(const Cell &_key) const;
+            void forEach(const std::function<void (const Cell &, const Cell &)> &_f) const;
+            bool operator==(const Map &_m) const;
+            bool operator!=(const Map &_m) const {return !(*this == _m);}
+    };
     using List = std::list<Cell>;
     class Cell{
         private:
-            std::variant<bool, int, float, std::string, Quotation, List, PtrProc> value;
+            std::variant<bool, Int, double, BigInt, std::string, Quotation, String, List, Vector, Map,
+                         PtrProc, PtrPromise, PtrObject> value;
         
         public:
             Cell(bool _b) : value(_b) {}
-            Cell(int _i) : value(_i) {}
-            Cell(float _f) : value(_f) {}
+            Cell(int _i) : value(Int(_i)) {}
+            Cell(Int _i) : value(_i) {}
+            Cell(double _d) : value(_d) {}
+            Cell(const BigInt &_b) : value(_b) {}
+            Cell(BigInt &&_b) : value(std::move(_b)) {}
             Cell(const std::string &_s) : value(_s) {}
+            Cell(std::string &&_s) : value(std::move(_s)) {}
             Cell(const Quotation &_q) : value(_q) {}
+            Cell(const String &_s) : value(_s) {}
             Cell(const List &_l) : value(_l) {}
+            Cell(List &&_l) : value(std::move(_l)) {}
+            Cell(const Vector &_v) : value(_v) {}
+            Cell(const Map &_m) : value(_m) {}
             Cell(const PtrProc &_p) : value(_p) {}
+            Cell(const PtrPromise &_p) : value(_p) {}
+            Cell(const PtrObject &_o) : value(_o) {}
             template<typename T>
             bool isType() const {return std::holds_alternative<T>(value);}
             template<typename T>
             T get() const {return std::get<T>(value);}
+            // borrows the value instead of copying it
+            template<typename T>
+            const T &ref() const {return std::get<T>(value);}
+            template<typename T>
+            T &ref() {return std::get<T>(value);}
             template<typename T>
             void visit(T _f) const {std::visit(_f, value);}
+            // same type and value, lists element-wise, procedures by identity
+            bool operator==(const Cell &_c) const {return value == _c.value;}
+            bool operator!=(const Cell &_c) const {return value != _c.value;}
+    };
+
+    // operands of an application, borrowed from the form or list that holds them
+    class Args{
+        private:
+            List::const_iterator first, last;
+            std::size_t count;
+
+        public:
+            Args(const List &_list) : first(_list.begin()), last(_list.end()), count(_list.size()) {}
+            Args(List::const_iterator _first, List::const_iterator _last, std::size_t _count)
+            : first(_first), last(_last), count(_count) {}
+            List::const_iterator begin() const {return first;}
+            List::const_iterator end() const {return last;}
+            std::size_t size() const {return count;}
+            bool empty() const {return count == 0;}
+            const Cell &front() const {return *first;}
+            const Cell &back() const {return *std::prev(last);}
+            // all but the first operand
+            Args tail() const {return Args(std::next(first), last, count - 1);}
     };
 
     class Environment;
     using PtrEnvir = std::shared_ptr<Environment>;
-    using Embedded = std::function<std::optional<Cell> (const List &_args, PtrEnvir &_envir)>;
+    using Names = std::unordered_set<std::string>;
+    using PtrNames = std::shared_ptr<const Names>;
+    using Embedded = std::function<std::optional<Cell> (Args _args, PtrEnvir &_envir)>;
+    // bindings of one frame, searched linearly until there are enough of them to index
+    class Bindings{
+        private:
+            std::vector<std::pair<std::string, Cell>> slots;
+            std::unordered_map<std::string, std::size_t> index;
+            static constexpr std::size_t indexFrom = 8;
+
+        public:
+            const Cell *find(const std::string &_name) const;
+            Cell *find(const std::string &_name)
+            {return const_cast<Cell *>(static_cast<const Bindings *>(this)->find(_name));}
+            void insert(const std::string &_name, Cell &&_cell);
+            // keeps the capacity, so a recycled frame binds without allocating
+            void clear();
+            auto begin() const {return slots.begin();}
+            auto end() const {return slots.end();}
+    };
+
     class Environment{
         private:
             std::unordered_map<std::string, Embedded> embeds;
-            std::unordered_map<std::string, Cell> vars;
-            const PtrEnvir parent;
+            Bindings vars;
+            PtrEnvir parent;
+            // names the code running in this frame may set! or define, nullptr if unknown
+            PtrNames assigned;
+            // next frame in the free list of the thread's frame pool
+            Environment *nextFree = nullptr;
             
-            Environment(const PtrEnvir &_parent = nullptr) : parent(_parent) {}
-            std::optional<Embedded> lookupEmbedsLocal(const std::string &_name) const;
-            std::optional<Cell> lookupVarsLocal(const std::string &_name) const;
+            Environment() = default;
+            const Embedded *lookupEmbedsLocal(const std::string &_name) const;
+            const Cell *lookupVarsLocal(const std::string &_name) const;
+            static void release(Environment *_envir);
         
         public:
-            std::optional<Embedded> lookupEmbeds(const std::string &_name) const;
-            std::optional<Cell> lookupVars(const std::string &_name) const;
+            // borrowed, valid until the frame gains or changes bindings
+            const Embedded *lookupEmbeds(const std::string &_name) const;
+            const Cell *lookupVars(const std::string &_name) const;
+            // whether a frame from this one up to _outer, exclusive, binds _name as a variable
+            bool bindsBefore(const std::string &_name, const Environment *_outer) const;
             bool extend(const std::string &_name, Embedded _embed);
             bool extend(const std::string &_name, const Cell &_cell);
+            bool extend(const std::string &_name, Cell &&_cell);
             bool bind(const std::vector<std::string> &_params, const List &_args);
             bool setVar(const std::string &_name, const Cell &_cell);
+            PtrEnvir capture(const Names &_free) const;
 
-            static PtrEnvir createEnvir(const PtrEnvir &_parent = nullptr)
-            {return PtrEnvir(new Environment(_parent));}
+            // Frames come from a per-thread pool and go back to it when the last reference,
+            // a running call or a closure that captured the frame, is released.
+            // Frames without their own assigned names inherit the parent's, as let frames do.
+            static PtrEnvir createEnvir(const PtrEnvir &_parent = nullptr);
+            static PtrEnvir createEnvir(const PtrEnvir &_parent, const PtrNames &_assigned);
             static Environment globalEnvir;
             static void initGlobalEnvir();
     };
 
+    // limits for one evaluation, 0 means unlimited
+    struct Budget{
+        std::size_t steps = 0;  // calls of evaluate
+        std::size_t fuel = 0;   // one per step plus one per operand applied
+        std::size_t depth = 0;  // nesting of applications
+        std::size_t heap = 0;   // bytes of frames and argument lists allocated
+    };
+
+    class Scheduler;
+
+    // Meters the evaluations on this thread while alive, nested meters are all charged.
+    // Once a budget runs out every check fails, so evaluation unwinds with std::nullopt.
+    class Meter{
+        private:
+            friend class Scheduler;
+
+            static inline thread_local Meter *current = nullptr;
+            Meter *prev;
+            const Budget limit;
+            Budget used;
+            std::size_t level = 0;
+            const char *reason = nullptr;
+
+            bool exceed(const char *_reason);
+            bool consume(std::size_t _steps, std::size_t _fuel, std::size_t _heap);
+            bool push();
+            void pop();
+
+        public:
+            explicit Meter(const Budget &_limit);
+            ~Meter();
+            Meter(const Meter &) = delete;
+            Meter &operator=(const Meter &) = delete;
+
+            const Budget &usage() const {return used;}
+            const char *exhausted() const {return reason;}
+
+            static bool step() {return !current || current->consume(1, 1, 0);}
+            static bool fuel(std::size_t _n) {return !current || current->consume(0, _n, 0);}
+            static bool alloc(std::size_t _bytes) {return !current || current->consume(0, 0, _bytes);}
+            static bool enter() {return !current || current->push();}
+            static void leave() {if(current) current->pop();}
+            // green threads keep their own meters, the scheduler swaps them on every switch
+            static Meter *swap(Meter *_meter) {auto meter = current; current = _meter; return meter;}
+            static bool active() {return current != nullptr;}
+            // told when a meter ends, so that tasks spawned under it stop referring to it
+            static inline thread_local void (*ending)(Meter *_meter) = nullptr;
+    };
+
+    // lowest address evaluation may use of the stack it runs on, set while a green thread runs
+    // and on the thread that called limitStack
+    inline thread_local const char *stackLimit = nullptr;
+    // sets stackLimit for the calling thread from its stack size, initGlobalEnvir calls it
+    void limitStack();
+
+    inline bool stackLeft()
+    {
+        char here;
+        if(stackLimit && &here < stackLimit){
+            std::cerr << "eval: stack exhausted" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
     std::optional<Cell> parseInput(std::istream &_in, bool quoted = false);
+    // characters of identifiers and number literals
+    bool isLegalChar(char _c);
+    // an integer or double if the whole token is one
+    std::optional<Cell> parseNumber(const std::string &_token);
+    // the character of an escape \<c> in a string literal
+    char unescapeChar(char _c);
     std::optional<Cell> evaluate(const Cell &_expr, PtrEnvir &_envir);
-    std::optional<Cell> apply(const Cell &_operat, const List &_operands, PtrEnvir &_envir);
+    std::optional<Cell> evaluate(const Cell &_expr, PtrEnvir &_envir, const Budget &_budget);
+    // _form is the whole form of the application, macro uses are expanded into it
+    std::optional<Cell> apply(const Cell &_operat, Args _operands, PtrEnvir &_envir, const Cell *_form = nullptr);
+    // applies a procedure or embed name to evaluated values, which are moved from
+    std::optional<Cell> applyValues(const Cell &_operat, std::vector<Cell> &_values, PtrEnvir &_envir);
+
+    // applyValues on copies of one or two values, for primitives that call back into procedures
+    inline std::optional<Cell> applyOne(const Cell &_f, const Cell &_x, PtrEnvir &_envir)
+    {
+        std::vector<Cell> values{_x};
+        return applyValues(_f, values, _envir);
+    }
+
+    inline std::optional<Cell> applyTwo(const Cell &_f, const Cell &_x, const Cell &_y, PtrEnvir &_envir)
+    {
+        std::vector<Cell> values{_x, _y};
+        return applyValues(_f, values, _envir);
+    }
 
     inline std::optional<Cell> parseString(const std::string &_str)
     {
@@ -83,15 +312,50 @@ namespace lisp
         return value;
     }
 
-    class Procedure{
-        private:
+    // free identifiers of a lambda and the names its body may set! or define
+    void analyzeLambda(const std::vector<std::string> &_params, const Cell &_body, Names &_free, Names &_assigned);
+
+    // A lambda form analyzed once. Its first evaluation moves the params and the body in here and
+    // leaves this in the form in place of the params, so later evaluations of the form skip the
+    // analysis and every closure made from it shares the body instead of copying it.
+    class Lambda : public Object{
+        public:
             std::vector<std::string> params;
+            // not const, macro uses in it are rewritten in place
             Cell body;
+            Names free;
+            // never nullptr, the names are known
+            PtrNames assigned;
+
+            Lambda(std::vector<std::string> _params, Cell _body);
+            const char *typeName() const override {return "Lambda";}
+    };
+    using PtrLambda = std::shared_ptr<const Lambda>;
+
+    class Procedure{
+        private:
+            const PtrLambda code;
             const PtrEnvir envir;
 
         public:
-            Procedure(const std::vector<std::string> &_params, const Cell &_body, const PtrEnvir &_envir)
-            : params(_params), body(_body), envir(_envir) {}
-            std::optional<Cell> operator()(const List &_args, PtrEnvir &_envir);
+            Procedure(const PtrLambda &_code, const PtrEnvir &_envir) : code(_code), envir(_envir) {}
+            std::optional<Cell> operator()(Args _args, PtrEnvir &_envir);
+            std::optional<Cell> invoke(std::vector<Cell> &_values);
+
+            // capture only the free variables of new closures instead of the whole defining chain
+            static inline bool flatCapture = true;
+    };
+
+    // a value computed on first force and memoized, the thunk is dropped once it ran
+    class Promise{
+        private:
+            std::optional<Cell> value;
+            std::function<std::optional<Cell> ()> thunk;
+
+        public:
+            explicit Promise(const Cell &_value) : value(_value) {}
+            explicit Promise(std::function<std::optional<Cell> ()> _thunk) : thunk(std::move(_thunk)) {}
+            ~Promise();
+            std::optional<Cell> force();
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,759 @@
+#include "lisp.h"
+#include "macro.h"
+#include <algorithm>
+
+namespace lisp
+{
+    // also under the alias name% a macro expansion uses where the use site shadows the form
+    static bool isForm(const List &_list, const char *_name)
+    {
+        auto &head = _list.front();
+        if(!head.isType<std::string>()){
+            return false;
+        }
+
+        auto &name = head.ref<std::string>();
+        return name == _name || (!name.empty() && name.back() == '%' && name.compare(0, name.size() - 1, _name) == 0);
+    }
+
+    static const Macro *macroOf(const Cell &_form, PtrEnvir &_envir, const Scope *_scope)
+    {
+        if(!_form.isType<List>() || _form.ref<List>().empty()){
+            return nullptr;
+        }
+
+        auto &head = _form.ref<List>().front();
+        if(!head.isType<std::string>()){
+            return nullptr;
+        }
+
+        // a variable of the same name hides the macro
+        auto &name = head.ref<std::string>();
+        if(_scope && std::find(_scope->begin(), _scope->end(), name) != _scope->end()){
+            return nullptr;
+        }
+        if(_envir->lookupVars(name)){
+            return nullptr;
+        }
+
+        auto embed = _envir->lookupEmbeds(name);
+        return embed ? embed->target<Macro>() : nullptr;
+    }
+
+    static bool expandHead(Cell &_form, PtrEnvir &_envir, const Scope *_scope)
+    {
+        while(auto macro = macroOf(_form, _envir, _scope)){
+            auto expansion = macro->expand(_form.ref<List>(), _envir, _scope);
+            if(!expansion){
+                std::cerr << "macro: cannot expand " << _form.ref<List>().front().ref<std::string>() << std::endl;
+                return false;
+            }
+
+            _form = std::move(expansion.value());
+        }
+
+        return true;
+    }
+
+    static bool expandIn(Cell &_form, PtrEnvir &_envir, Scope &_scope);
+
+    bool expandForm(Cell &_form, PtrEnvir &_envir)
+    {
+        Scope scope;
+        return expandIn(_form, _envir, scope);
+    }
+
+    static void bindName(const Cell &_name, Scope &_scope)
+    {
+        if(_name.isType<std::string>()){
+            _scope.push_back(_name.ref<std::string>());
+        }
+    }
+
+    static bool expandIn(Cell &_form, PtrEnvir &_envir, Scope &_scope)
+    {
+        if(!expandHead(_form, _envir, &_scope)){
+            return false;
+        }
+        if(!_form.isType<List>()){
+            return true;
+        }
+
+        auto &list = _form.ref<List>();
+        if(list.empty()){
+            return true;
+        }
+
+        if(isForm(list, "quote") || isForm(list, "define-syntax") || isForm(list, "defmacro")){
+            return true;
+        }
+
+        auto size = _scope.size();
+        auto it = list.begin();
+
+        // (lambda (<param> ...) <body>)
+        if(isForm(list, "lambda") && list.size() == 3){
+            auto &params = *++it;
+            if(params.isType<List>()){
+                for(auto &param : params.ref<List>()){
+                    bindName(param, _scope);
+                }
+            }
+
+            bool ok = expandIn(list.back(), _envir, _scope);
+            _scope.resize(size);
+            return ok;
+        }
+
+        // (let [<name>] (<var> <expr>) ... <body>)
+        if(isForm(list, "let") && list.size() >= 3){
+            auto last = --list.end();
+            ++it;
+            if(it->isType<std::string>()){
+                bindName(*it++, _scope);
+            }
+
+            Scope vars;
+            for(; it != last; it++){
+                if(it->isType<List>() && it->ref<List>().size() == 2){
+                    if(!expandIn(it->ref<List>().back(), _envir, _scope)){
+                        return false;
+                    }
+                    bindName(it->ref<List>().front(), vars);
+                }
+            }
+
+            _scope.insert(_scope.end(), vars.begin(), vars.end());
+            bool ok = expandIn(*last, _envir, _scope);
+            _scope.resize(size);
+            return ok;
+        }
+
+        // (define <name> <value>) and (set! <name> <value>)
+        if((isForm(list, "define") || isForm(list, "set!")) && list.size() == 3){
+            if(isForm(list, "define")){
+                bindName(*std::next(it), _scope);
+            }
+            return expandIn(list.back(), _envir, _scope);
+        }
+
+        // (cond (<cond> <expr>) ... <default>)
+        if(isForm(list, "cond")){
+            auto last = --list.end();
+            for(++it; it != last; it++){
+                if(it->isType<List>()){
+                    for(auto &cell : it->ref<List>()){
+                        if(!expandIn(cell, _envir, _scope)){
+                            return false;
+                        }
+                    }
+                }
+            }
+            return expandIn(*last, _envir, _scope);
+        }
+
+        for(auto &cell : list){
+            if(!expandIn(cell, _envir, _scope)){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool expandAll(Cell &_form, PtrEnvir &_envir, Scope _scope)
+    {
+        return expandIn(_form, _envir, _scope);
+    }
+
+    std::optional<Cell> Macro::operator()(Args _args, PtrEnvir &_envir) const
+    {
+        List form{std::string("_")};
+        form.insert(form.end(), _args.begin(), _args.end());
+
+        auto expansion = expand(form, _envir);
+        if(!expansion || !expandForm(expansion.value(), _envir)){
+            return std::nullopt;
+        }
+
+        return evaluate(expansion.value(), _envir);
+    }
+
+    // syntax-rules
+
+    static bool isIdentifier(const Cell &_cell, const char *_name)
+    {
+        return _cell.isType<std::string>() && _cell.ref<std::string>() == _name;
+    }
+
+    // what a pattern variable matched, a form or, below an ellipsis, one match per repetition
+    struct Match{
+        std::optional<Cell> form;
+        std::vector<Match> items;
+    };
+    using Matches = std::unordered_map<std::string, Match>;
+
+    struct Rule{
+        Cell pattern;       // without the keyword
+        Cell templ;
+        Names binders;      // names the template binds itself, renamed in every expansion
+        Names free;         // names the template refers to, aliased where the use site binds them
+    };
+
+    struct Rules{
+        std::string name;
+        Names literals;
+        std::vector<Rule> rules;
+        std::weak_ptr<Environment> definition;  // empty for the global environment
+        bool global = true;
+        // what a free name is replaced by when shadowed, made on first use
+        mutable std::unordered_map<std::string, Cell> aliases;
+    };
+
+    static void patternVars(const Cell &_pattern, const Names &_literals, std::vector<std::string> &_vars)
+    {
+        if(_pattern.isType<std::string>()){
+            auto &name = _pattern.ref<std::string>();
+            if(name != "_" && name != "..." && !_literals.count(name)){
+                _vars.push_back(name);
+            }
+        }
+        else if(_pattern.isType<List>()){
+            for(auto &cell : _pattern.ref<List>()){
+                patternVars(cell, _literals, _vars);
+            }
+        }
+    }
+
+    static bool match(const Cell &_pattern, const Cell &_form, const Names &_literals, Matches &_matches)
+    {
+        if(_pattern.isType<std::string>()){
+            auto &name = _pattern.ref<std::string>();
+            if(name == "_"){
+                return true;
+            }
+            if(_literals.count(name)){
+                return _form.isType<std::string>() && _form.ref<std::string>() == name;
+            }
+
+            _matches[name].form = _form;
+            return true;
+        }
+
+        if(!_pattern.isType<List>()){
+            return _pattern == _form;
+        }
+        if(!_form.isType<List>()){
+            return false;
+        }
+
+        auto &pattern = _pattern.ref<List>();
+        auto &form = _form.ref<List>();
+
+        // <pattern> ... matches any number of forms, the patterns after it match the last forms
+        auto ellipsis = std::find_if(pattern.begin(), pattern.end(),
+            [](const Cell &_cell){return isIdentifier(_cell, "...");});
+
+        if(ellipsis == pattern.end()){
+            if(pattern.size() != form.size()){
+                return false;
+            }
+
+            auto f = form.begin();
+            for(auto &p : pattern){
+                if(!match(p, *f++, _literals, _matches)){
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        if(ellipsis == pattern.begin()){
+            return false;
+        }
+
+        auto repeated = std::prev(ellipsis);
+        std::size_t before = std::distance(pattern.begin(), repeated);
+        std::size_t after = std::distance(std::next(ellipsis), pattern.end());
+        if(form.size() < before + after){
+            return false;
+        }
+
+        auto p = pattern.begin();
+        auto f = form.begin();
+        for(; p != repeated; p++, f++){
+            if(!match(*p, *f, _literals, _matches)){
+                return false;
+            }
+        }
+
+        std::vector<std::string> vars;
+        patternVars(*repeated, _literals, vars);
+        for(auto &var : vars){
+            _matches[var].items.clear();
+        }
+
+        for(auto count = form.size() - before - after; count > 0; count--, f++){
+            Matches one;
+            if(!match(*repeated, *f, _literals, one)){
+                return false;
+            }
+            for(auto &var : vars){
+                _matches[var].items.push_back(std::move(one[var]));
+            }
+        }
+
+        for(p = std::next(ellipsis); p != pattern.end(); p++, f++){
+            if(!match(*p, *f, _literals, _matches)){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // pattern variables of _templ that repeat at this level of _matches
+    static void repeatedVars(const Cell &_templ, const Matches &_matches, std::vector<std::string> &_vars)
+    {
+        if(_templ.isType<std::string>()){
+            auto it = _matches.find(_templ.ref<std::string>());
+            if(it != _matches.end() && !it->second.form
+                && std::find(_vars.begin(), _vars.end(), it->first) == _vars.end()){
+                _vars.push_back(it->first);
+            }
+        }
+        else if(_templ.isType<List>()){
+            for(auto &cell : _templ.ref<List>()){
+                repeatedVars(cell, _matches, _vars);
+            }
+        }
+    }
+
+    using Renames = std::unordered_map<std::string, Cell>;
+
+    static std::optional<Cell> instantiate(const Cell &_templ, const Matches &_matches, const Renames &_renames,
+                                           const std::string &_name)
+    {
+        if(_templ.isType<std::string>()){
+            auto &name = _templ.ref<std::string>();
+
+            auto matched = _matches.find(name);
+            if(matched != _matches.end()){
+                if(!matched->second.form){
+                    std::cerr << _name << ": " << name << " needs an ellipsis in the template" << std::endl;
+                    return std::nullopt;
+                }
+                return matched->second.form;
+            }
+
+            auto renamed = _renames.find(name);
+            return renamed != _renames.end() ? renamed->second : _templ;
+        }
+
+        if(!_templ.isType<List>()){
+            return _templ;
+        }
+
+        List list;
+        auto &templ = _templ.ref<List>();
+
+        // quoted data keeps the names the template wrote, pattern variables are still substituted
+        if(!templ.empty() && isForm(templ, "quote") && !_renames.empty()){
+            return instantiate(_templ, _matches, Renames(), _name);
+        }
+
+        for(auto it = templ.begin(); it != templ.end(); it++){
+            auto next = std::next(it);
+            if(next == templ.end() || !isIdentifier(*next, "...")){
+                auto cell = instantiate(*it, _matches, _renames, _name);
+                if(!cell){
+                    return std::nullopt;
+                }
+                list.push_back(std::move(cell.value()));
+                continue;
+            }
+
+            // <template> ... repeats once per match of the pattern variables inside it
+            std::vector<std::string> vars;
+            repeatedVars(*it, _matches, vars);
+            if(vars.empty()){
+                std::cerr << _name << ": ellipsis without pattern variables" << std::endl;
+                return std::nullopt;
+            }
+
+            auto count = _matches.at(vars.front()).items.size();
+            for(auto &var : vars){
+                if(_matches.at(var).items.size() != count){
+                    std::cerr << _name << ": " << var << " repeats a different number of times" << std::endl;
+                    return std::nullopt;
+                }
+            }
+
+            for(std::size_t i = 0; i < count; i++){
+                auto matches = _matches;
+                for(auto &var : vars){
+                    matches[var] = _matches.at(var).items[i];
+                }
+
+                auto cell = instantiate(*it, matches, _renames, _name);
+                if(!cell){
+                    return std::nullopt;
+                }
+                list.push_back(std::move(cell.value()));
+            }
+            it = next;
+        }
+
+        return list;
+    }
+
+    // names the template binds with lambda, let or define that are not pattern variables
+    static void templateBinders(const Cell &_templ, const Names &_vars, Names &_binders)
+    {
+        if(!_templ.isType<List>() || _templ.ref<List>().empty() || isForm(_templ.ref<List>(), "quote")){
+            return;
+        }
+
+        auto &list = _templ.ref<List>();
+        auto bind = [&](const Cell &_name)
+            {
+                if(_name.isType<std::string>() && !_vars.count(_name.ref<std::string>())
+                    && _name.ref<std::string>() != "..."){
+                    _binders.insert(_name.ref<std::string>());
+                }
+            };
+
+        if(isForm(list, "lambda") && list.size() == 3){
+            auto &params = *std::next(list.begin());
+            if(params.isType<List>()){
+                for(auto &param : params.ref<List>()){
+                    bind(param);
+                }
+            }
+        }
+        else if(isForm(list, "let")){
+            for(auto it = std::next(list.begin()); it != list.end(); it++){
+                if(it == std::next(list.begin()) && it->isType<std::string>()){
+                    bind(*it);
+                }
+                else if(it->isType<List>() && it->ref<List>().size() == 2){
+                    bind(it->ref<List>().front());
+                }
+            }
+        }
+        else if(isForm(list, "define") && list.size() == 3){
+            bind(*std::next(list.begin()));
+        }
+
+        for(auto &cell : list){
+            templateBinders(cell, _vars, _binders);
+        }
+    }
+
+    // identifiers of the template outside quoted data that it neither binds nor matched
+    static void templateFree(const Cell &_templ, const Names &_vars, const Names &_binders, Names &_free)
+    {
+        if(_templ.isType<std::string>()){
+            auto &name = _templ.ref<std::string>();
+            if(name != "..." && name != "_" && !_vars.count(name) && !_binders.count(name)){
+                _free.insert(name);
+            }
+        }
+        else if(_templ.isType<List>() && !_templ.ref<List>().empty() && !isForm(_templ.ref<List>(), "quote")){
+            for(auto &cell : _templ.ref<List>()){
+                templateFree(cell, _vars, _binders, _free);
+            }
+        }
+    }
+
+    // a name as the definition environment of _rules has it, std::nullopt if unbound there.
+    // An embed is copied into the global environment under name% when it is global itself,
+    // else under a fresh name. A variable is read by a call to a fresh embed, as set! may
+    // change it after the expansion.
+    static std::optional<Cell> aliasOf(const Rules &_rules, const std::string &_name)
+    {
+        static std::size_t made = 0;
+
+        auto found = _rules.aliases.find(_name);
+        if(found != _rules.aliases.end()){
+            return found->second;
+        }
+
+        auto definition = _rules.definition.lock();
+        if(!_rules.global && !definition){
+            return std::nullopt;
+        }
+
+        auto &global = Environment::globalEnvir;
+        const Environment &envir = definition ? *definition : global;
+        std::optional<Cell> alias;
+
+        if(envir.lookupVars(_name)){
+            auto reader = _name + "%" + std::to_string(++made);
+            global.extend(reader, [weak = _rules.definition, _name](Args _args, PtrEnvir &) -> std::optional<Cell>
+                {
+                    auto definition = weak.lock();
+                    auto cell = definition ? definition->lookupVars(_name) : Environment::globalEnvir.lookupVars(_name);
+                    if(!_args.empty() || !cell){
+                        std::cerr << _name << ": not bound where the macro was defined" << std::endl;
+                        return std::nullopt;
+                    }
+                    return *cell;
+                }
+            );
+            alias = List{reader};
+        }
+        else if(auto embed = envir.lookupEmbeds(_name)){
+            auto name = embed == global.lookupEmbeds(_name) ? _name + "%" : _name + "%" + std::to_string(++made);
+            if(!global.lookupEmbeds(name)){
+                global.extend(name, *embed);
+            }
+            alias = name;
+        }
+        else{
+            return std::nullopt;
+        }
+
+        _rules.aliases.emplace(_name, alias.value());
+        return alias;
+    }
+
+    static std::optional<Cell> expandRules(const Rules &_rules, const List &_form, PtrEnvir &_envir, const Scope *_scope)
+    {
+        static std::size_t renamed = 0;
+
+        Cell operands = List(std::next(_form.begin()), _form.end());
+
+        for(auto &rule : _rules.rules){
+            Matches matches;
+            if(!match(rule.pattern, operands, _rules.literals, matches)){
+                continue;
+            }
+
+            // fresh names for what the template binds, so it cannot capture names of the use site
+            Renames renames;
+            if(!rule.binders.empty()){
+                renamed++;
+                for(auto &name : rule.binders){
+                    renames.insert_or_assign(name, name + "%" + std::to_string(renamed));
+                }
+            }
+
+            // and the meaning of the definition site for free names the use site binds
+            auto definition = _rules.definition.lock();
+            for(auto &name : rule.free){
+                bool shadowed = (_scope && std::find(_scope->begin(), _scope->end(), name) != _scope->end())
+                    || _envir->bindsBefore(name, definition.get());
+                if(!shadowed){
+                    continue;
+                }
+
+                auto alias = aliasOf(_rules, name);
+                if(alias){
+                    renames.insert_or_assign(name, std::move(alias.value()));
+                }
+            }
+
+            return instantiate(rule.templ, matches, renames, _rules.name);
+        }
+
+        std::cerr << _rules.name << ": no syntax rule matches" << std::endl;
+        return std::nullopt;
+    }
+
+    std::optional<Macro> syntaxRules(const Cell &_spec, const std::string &_name, const PtrEnvir &_definition)
+    {
+        if(!_spec.isType<List>() || _spec.ref<List>().size() < 2 || !isForm(_spec.ref<List>(), "syntax-rules")){
+            std::cerr << _name << ": need (syntax-rules (<literal> ...) (<pattern> <template>) ...)" << std::endl;
+            return std::nullopt;
+        }
+
+        auto rules = std::make_shared<Rules>();
+        rules->name = _name;
+        rules->definition = _definition;
+        rules->global = _definition == nullptr;
+
+        auto &spec = _spec.ref<List>();
+        auto it = std::next(spec.begin());
+        if(!it->isType<List>()){
+            std::cerr << _name << ": invalid literals" << std::endl;
+            return std::nullopt;
+        }
+        for(auto &literal : it->ref<List>()){
+            if(!literal.isType<std::string>()){
+                std::cerr << _name << ": invalid literals" << std::endl;
+                return std::nullopt;
+            }
+            rules->literals.insert(literal.ref<std::string>());
+        }
+
+        for(it++; it != spec.end(); it++){
+            if(!it->isType<List>() || it->ref<List>().size() != 2
+                || !it->ref<List>().front().isType<List>() || it->ref<List>().front().ref<List>().empty()){
+                std::cerr << _name << ": rules are (<pattern> <template>)" << std::endl;
+                return std::nullopt;
+            }
+
+            // the keyword position of the pattern is not matched
+            auto &pattern = it->ref<List>().front().ref<List>();
+            Rule rule{List(std::next(pattern.begin()), pattern.end()), it->ref<List>().back(), {}, {}};
+
+            std::vector<std::string> vars;
+            patternVars(rule.pattern, rules->literals, vars);
+            Names names(vars.begin(), vars.end());
+            templateBinders(rule.templ, names, rule.binders);
+            templateFree(rule.templ, names, rule.binders, rule.free);
+
+            rules->rules.push_back(std::move(rule));
+        }
+
+        return Macro([rules](const List &_form, PtrEnvir &_envir, const Scope *_scope)
+            {
+                return expandRules(*rules, _form, _envir, _scope);
+            }
+        );
+    }
+
+    Embedded makeSyntaxRules(const std::string &_name, const std::string &_spec)
+    {
+        return syntaxRules(parseString(_spec).value(), _name).value();
+    }
+
+    // (define-syntax <name> (syntax-rules ...))
+    std::optional<Cell> buildinDefineSyntax(Args _args, PtrEnvir &_envir)
+    {
+        if(_args.size() != 2 || !_args.front().isType<std::string>()){
+            std::cerr << "define-syntax: need a name and syntax-rules" << std::endl;
+            return std::nullopt;
+        }
+
+        auto &name = _args.front().ref<std::string>();
+        auto macro = syntaxRules(_args.back(), name, _envir);
+        if(!macro){
+            return std::nullopt;
+        }
+
+        if(!_envir->extend(name, Embedded(std::move(macro.value())))){
+            std::cerr << "define-syntax: name conflict" << std::endl;
+            return std::nullopt;
+        }
+
+        return name;
+    }
+
+    // identifiers reach a defmacro body as quoted symbols, a variable bound to a bare identifier
+    // would be looked up again
+    static void identifiersToSymbols(Cell &_form)
+    {
+        if(_form.isType<std::string>()){
+            _form = Quotation(_form.ref<std::string>());
+        }
+        else if(_form.isType<List>() && !_form.ref<List>().empty() && !isForm(_form.ref<List>(), "quote")){
+            for(auto &cell : _form.ref<List>()){
+                identifiersToSymbols(cell);
+            }
+        }
+    }
+
+    // and quoted symbols in the expansion it computes, like 'if in (list 'if c ...), stand for identifiers
+    static void symbolsToIdentifiers(Cell &_form)
+    {
+        if(_form.isType<Quotation>()){
+            _form = _form.ref<Quotation>().str();
+        }
+        else if(_form.isType<List>() && !_form.ref<List>().empty() && !isForm(_form.ref<List>(), "quote")){
+            for(auto &cell : _form.ref<List>()){
+                symbolsToIdentifiers(cell);
+            }
+        }
+    }
+
+    // (defmacro <name> (<param> ... [. <rest>]) <body>), body computes the expansion from
+    // the unevaluated operands
+    std::optional<Cell> buildinDefmacro(Args _args, PtrEnvir &_envir)
+    {
+        if(_args.size() != 3 || !_args.front().isType<std::string>() || !std::next(_args.begin())->isType<List>()){
+            std::cerr << "defmacro: need a name, a param list and a body" << std::endl;
+            return std::nullopt;
+        }
+
+        auto &name = _args.front().ref<std::string>();
+
+        List params;
+        bool rest = false;
+        for(auto &param : std::next(_args.begin())->ref<List>()){
+            if(isIdentifier(param, ".")){
+                rest = true;
+                continue;
+            }
+            params.push_back(param);
+        }
+
+        if(rest && params.empty()){
+            std::cerr << "defmacro: . needs a name after it" << std::endl;
+            return std::nullopt;
+        }
+
+        // the body is expanded here, it is not part of a form expandAll walks
+        Scope scope;
+        for(auto &param : params){
+            if(param.isType<std::string>()){
+                scope.push_back(param.ref<std::string>());
+            }
+        }
+
+        List lambda{std::move(params), _args.back()};
+        if(!expandAll(lambda.back(), _envir, scope)){
+            return std::nullopt;
+        }
+
+        // lambda moves the params out of the form
+        auto fixed = lambda.front().ref<List>().size() - rest;
+        auto proc = buildinLambda(lambda, _envir);
+        if(!proc){
+            return std::nullopt;
+        }
+
+        Macro macro([proc = proc.value(), fixed, rest, name](const List &_form, PtrEnvir &_envir, const Scope *) -> std::optional<Cell>
+            {
+                auto operands = _form.size() - 1;
+                if(rest ? operands < fixed : operands != fixed){
+                    std::cerr << name << ": wrong number of operands" << std::endl;
+                    return std::nullopt;
+                }
+
+                std::vector<Cell> values(std::next(_form.begin()), std::next(_form.begin(), 1 + fixed));
+                if(rest){
+                    values.push_back(List(std::next(_form.begin(), 1 + fixed), _form.end()));
+                }
+                for(auto &value : values){
+                    identifiersToSymbols(value);
+                }
+
+                auto expansion = applyValues(proc, values, _envir);
+                if(expansion){
+                    symbolsToIdentifiers(expansion.value());
+                }
+                return expansion;
+            }
+        );
+
+        if(!_envir->extend(name, Embedded(std::move(macro)))){
+            std::cerr << "defmacro: name conflict" << std::endl;
+            return std::nullopt;
+        }
+
+        return name;
+    }
+
+    // (gensym) => a new identifier, for defmacro expansions that bind names
+    std::optional<Cell> buildinGensym(Args _args, PtrEnvir &)
+    {
+        static std::size_t count = 0;
+
+        if(!_args.empty()){
+            std::cerr << "gensym: need no args" << std::endl;
+            return std::nullopt;
+        }
+
+        return std::string("g%") + std::to_string(++count);
+    }
+}
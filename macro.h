@@ -0,0 +1,43 @@
+#pragma once
+#include "lispbase.h"
+
+namespace lisp
+{
+    // identifiers bound by the code around a form, innermost last
+    using Scope = std::vector<std::string>;
+
+    // Macros are embeds of this type. apply writes the rewrite of a macro form over the form,
+    // so each use is expanded once and afterwards runs as the core forms it expanded into.
+    // Forms read from source go through expandAll once before they are evaluated, lambda does
+    // not expand its body, so uses missed there are expanded when first applied.
+    class Macro{
+        public:
+            // the whole form, keyword included, to its rewrite, _scope holds names bound around
+            // the form that _envir does not bind yet, nullptr when there are none
+            using Expander = std::function<std::optional<Cell> (const List &_form, PtrEnvir &_envir, const Scope *_scope)>;
+
+        private:
+            Expander expander;
+
+        public:
+            explicit Macro(Expander _expander) : expander(std::move(_expander)) {}
+            std::optional<Cell> expand(const List &_form, PtrEnvir &_envir, const Scope *_scope = nullptr) const
+            {return expander(_form, _envir, _scope);}
+            // a use without a form to cache into, the expansion is evaluated and dropped
+            std::optional<Cell> operator()(Args _args, PtrEnvir &_envir) const;
+    };
+
+    // rewrites _form in place for as long as it is a macro use, then expands the rewrite
+    bool expandForm(Cell &_form, PtrEnvir &_envir);
+    // expandForm on _form and every form inside it, quoted data and names being bound excepted,
+    // _scope holds names bound around _form that _envir does not bind yet
+    bool expandAll(Cell &_form, PtrEnvir &_envir, Scope _scope = Scope());
+
+    // Compiles (syntax-rules (<literal> ...) (<pattern> <template>) ...) defined in _definition,
+    // nullptr for the global environment. Expansions are hygienic: names the template binds are
+    // renamed, and a free name of the template that the use site binds is replaced by an alias
+    // meaning what the name means where the macro was defined.
+    std::optional<Macro> syntaxRules(const Cell &_spec, const std::string &_name, const PtrEnvir &_definition = nullptr);
+    // syntaxRules from source text, for the derived forms of the global environment
+    Embedded makeSyntaxRules(const std::string &_name, const std::string &_spec);
+}
@@ -1,4 +1,5 @@
 #include "lisp.h"
+#include "macro.h"
 #include <functional>
 #include <sstream>
 #include <fstream>
@@ -6,7 +7,7 @@
 void printCell(const lisp::Cell &_cell)
 {
     if(_cell.isType<lisp::List>()){
-        auto list = _cell.get<lisp::List>();
+        auto &list = _cell.ref<lisp::List>();
         std::cout << '(';
         
         auto it = list.begin();
@@ -28,10 +29,13 @@ void printCell(const lisp::Cell &_cell)
                 if constexpr(std::is_same_v<T, bool>){
                     std::cout << 'b' << _argu;
                 }
-                else if constexpr(std::is_same_v<T, int>){
+                else if constexpr(std::is_same_v<T, lisp::Int>){
                     std::cout << 'i' << _argu;
                 }
-                else if constexpr(std::is_same_v<T, float>){
+                else if constexpr(std::is_same_v<T, lisp::BigInt>){
+                    std::cout << 'i' << _argu.toString();
+                }
+                else if constexpr(std::is_same_v<T, double>){
                     std::cout << 'f' << _argu;
                 }
                 else if constexpr(std::is_same_v<T, std::string>){
@@ -40,9 +44,40 @@ void printCell(const lisp::Cell &_cell)
                 else if constexpr(std::is_same_v<T, lisp::Quotation>){
                     std::cout << '\"' << _argu.str() << '\"';
                 }
+                else if constexpr(std::is_same_v<T, lisp::String>){
+                    std::cout << 's' << '\"' << _argu.str() << '\"';
+                }
+                else if constexpr(std::is_same_v<T, lisp::Vector>){
+                    std::cout << '[';
+                    for(std::size_t i = 0; i < _argu.size(); i++){
+                        std::cout << (i ? " " : "");
+                        printCell(_argu.at(i));
+                    }
+                    std::cout << ']';
+                }
+                else if constexpr(std::is_same_v<T, lisp::Map>){
+                    bool first = true;
+                    std::cout << '{';
+                    _argu.forEach([&first](const lisp::Cell &_key, const lisp::Cell &_value)
+                        {
+                            std::cout << (first ? "" : ", ");
+                            printCell(_key);
+                            std::cout << ' ';
+                            printCell(_value);
+                            first = false;
+                        }
+                    );
+                    std::cout << '}';
+                }
                 else if constexpr(std::is_same_v<T, lisp::PtrProc>){
                     std::cout << "Procedure";
                 }
+                else if constexpr(std::is_same_v<T, lisp::PtrPromise>){
+                    std::cout << "Promise";
+                }
+                else if constexpr(std::is_same_v<T, lisp::PtrObject>){
+                    std::cout << _argu->typeName();
+                }
             }
         );
     }
@@ -71,7 +106,7 @@ int main(int argc, char *argv[])
         if(cell){
             printCell(cell.value());
             std::cout << std::endl;
-            auto value = lisp::evaluate(cell.value(), env);
+            auto value = lisp::expandAll(cell.value(), env) ? lisp::evaluate(cell.value(), env) : std::nullopt;
 
             if(value){
                 printCell(value.value());
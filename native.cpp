@@ -0,0 +1,66 @@
+#ifndef _WIN32
+#include "lisp.h"
+#include "native.h"
+#include <dlfcn.h>
+#include <map>
+
+namespace lisp
+{
+    // primitives of a module go into the global environment, next to the builtins
+    class GlobalRegistry : public Registry{
+        public:
+            bool define(const std::string &_name, Embedded _embed) override
+            {
+                return Environment::globalEnvir.extend(_name, std::move(_embed));
+            }
+    };
+
+    // (load-native <path>) => true once the module registered its primitives
+    // modules stay loaded, since their primitives may be called at any time
+    std::optional<Cell> buildinLoadNative(Args _args, PtrEnvir &)
+    {
+        auto path = _args.size() == 1 ? pathOf(_args.front()) : std::nullopt;
+        if(!path){
+            std::cerr << "load-native: need a path" << std::endl;
+            return std::nullopt;
+        }
+
+        static std::map<std::string, void *> loaded;
+        if(loaded.count(path.value())){
+            return true;
+        }
+
+        auto handle = dlopen(path.value().c_str(), RTLD_NOW | RTLD_LOCAL);
+        if(!handle){
+            std::cerr << "load-native: " << dlerror() << std::endl;
+            return std::nullopt;
+        }
+
+        auto abi = reinterpret_cast<LispNativeAbi>(dlsym(handle, "lisp_native_abi"));
+        auto init = reinterpret_cast<LispNativeInit>(dlsym(handle, "lisp_native_init"));
+        if(!(abi && init)){
+            std::cerr << "load-native: " << path.value() << " is not a native module" << std::endl;
+            dlclose(handle);
+            return std::nullopt;
+        }
+
+        if(abi() != LISP_NATIVE_ABI){
+            std::cerr << "load-native: " << path.value() << " was built for ABI " << abi()
+                      << ", need " << LISP_NATIVE_ABI << std::endl;
+            dlclose(handle);
+            return std::nullopt;
+        }
+
+        GlobalRegistry registry;
+        if(!init(&registry)){
+            // some primitives may be registered already, so the module stays
+            std::cerr << "load-native: " << path.value() << " failed to initialize" << std::endl;
+            loaded[path.value()] = handle;
+            return std::nullopt;
+        }
+
+        loaded[path.value()] = handle;
+        return true;
+    }
+}
+#endif
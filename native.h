@@ -0,0 +1,34 @@
+#pragma once
+#include "lispbase.h"
+#include "embed.h"
+
+// Native modules are shared libraries loaded by (load-native "libfoo.so"). They export two
+// C symbols through LISP_NATIVE_MODULE and register primitives the way buildin.cpp does:
+//
+//     LISP_NATIVE_MODULE(_registry)
+//     {
+//         return _registry->define("square", lisp::makeEmbed<lisp::Int (lisp::Int)>([](lisp::Int _i){return _i * _i;}));
+//     }
+//
+// Cell and Embedded cross the boundary as C++ types, so a module has to be built with the
+// same compiler and headers as the interpreter. LISP_NATIVE_ABI is bumped whenever they change.
+#define LISP_NATIVE_ABI 6
+
+namespace lisp
+{
+    class Registry{
+        public:
+            virtual ~Registry() = default;
+            // embeds get their operands unevaluated, makeEmbed and makeOverload evaluate them
+            virtual bool define(const std::string &_name, Embedded _embed) = 0;
+    };
+}
+
+extern "C"{
+    typedef int (*LispNativeAbi)();
+    typedef bool (*LispNativeInit)(lisp::Registry *);
+}
+
+#define LISP_NATIVE_MODULE(_registry) \
+    extern "C" int lisp_native_abi() {return LISP_NATIVE_ABI;} \
+    extern "C" bool lisp_native_init(lisp::Registry *_registry)
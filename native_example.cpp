@@ -0,0 +1,40 @@
+// an example native module, (load-native "liblispnative_example.so") adds square, clamp and dot
+#include "native.h"
+#include <algorithm>
+
+LISP_NATIVE_MODULE(_registry)
+{
+    auto square = lisp::makeEmbed<lisp::Int (lisp::Int)>([](lisp::Int _i){return _i * _i;});
+
+    auto clamp = lisp::makeOverload<lisp::Int (lisp::Int, lisp::Int, lisp::Int), double (double, double, double)>(
+        [](lisp::Int _x, lisp::Int _low, lisp::Int _high){return std::clamp(_x, _low, _high);},
+        [](double _x, double _low, double _high){return std::clamp(_x, _low, _high);}
+    );
+
+    // (dot <list> <list>) of fixnums
+    auto dot = lisp::wrap(
+        [](lisp::Args _args, lisp::PtrEnvir &) -> std::optional<lisp::Cell>
+        {
+            if(_args.size() != 2 || !_args.front().isType<lisp::List>() || !_args.back().isType<lisp::List>()){
+                return std::nullopt;
+            }
+
+            auto &xs = _args.front().ref<lisp::List>();
+            auto &ys = _args.back().ref<lisp::List>();
+            lisp::Int sum = 0;
+
+            for(auto x = xs.begin(), y = ys.begin(); x != xs.end() && y != ys.end(); x++, y++){
+                if(!(x->isType<lisp::Int>() && y->isType<lisp::Int>())){
+                    return std::nullopt;
+                }
+                sum += x->get<lisp::Int>() * y->get<lisp::Int>();
+            }
+
+            return sum;
+        }
+    );
+
+    return _registry->define("square", square)
+        && _registry->define("clamp", clamp)
+        && _registry->define("dot", dot);
+}
@@ -1,42 +1,60 @@
 #include "lispbase.h"
 #include <cctype>
+#include <cerrno>
+#include <cstdlib>
 #include <sstream>
 
 namespace lisp
 {
-    static bool isLegalChar(char _c)
+    bool isLegalChar(char _c)
     {
         if(isalnum(_c)){
             return true;
         }
 
-        std::string chars = "_.+-*/=<>!?";
+        static const std::string chars = "_.+-*/=<>!?:";
 
         return chars.find(_c) != std::string::npos;
     }
 
-    static std::optional<Cell> parseInt(const std::string &_str)
+    std::optional<Cell> parseNumber(const std::string &_token)
     {
-        std::istringstream sin(_str);
-        int value;
+        // only tokens shaped like numbers, so inf or nan stay identifiers
+        auto digits = _token.find_first_not_of("+-.");
+        if(digits == std::string::npos || digits > 2 || !isdigit(static_cast<unsigned char>(_token[digits]))){
+            return std::nullopt;
+        }
+
+        char *end = nullptr;
+
+        errno = 0;
+        auto i = std::strtoll(_token.c_str(), &end, 10);
+        if(*end == '\0'){
+            if(errno == 0){
+                return Int(i);
+            }
 
-        if((sin >> value) && (sin.eof())){
-            return value;
+            // too long for a fixnum
+            return BigInt::fromString(_token);
         }
-        
+
+        auto d = std::strtod(_token.c_str(), &end);
+        if(*end == '\0'){
+            return d;
+        }
+
         return std::nullopt;
     }
 
-    static std::optional<Cell> parseFloat(const std::string &_str)
+    char unescapeChar(char _c)
     {
-        std::istringstream sin(_str);
-        float value;
-
-        if((sin >> value) && (sin.eof())){
-            return value;
+        switch(_c){
+            case 'n': return '\n';
+            case 't': return '\t';
+            case 'r': return '\r';
+            case '0': return '\0';
+            default: return _c;
         }
-
-        return std::nullopt;
     }
 
     static std::optional<Cell> parseIdentifier(const std::string &_str)
@@ -74,12 +92,7 @@ namespace lisp
             return Quotation(value);
         }
 
-        auto cell = parseInt(value);
-        if(cell){
-            return cell;
-        }
-
-        cell = parseFloat(value);
+        auto cell = parseNumber(value);
         if(cell){
             return cell;
         }
@@ -87,6 +100,35 @@ namespace lisp
         return parseIdentifier(value);
     }
 
+    // "<text>", with backslash escapes
+    static std::optional<Cell> parseText(std::istream &_in)
+    {
+        std::string value;
+        _in.get();
+
+        while(true){
+            auto ch = _in.get();
+
+            if(!_in.good()){
+                return std::nullopt;
+            }
+
+            if(ch == '"'){
+                return String(std::move(value));
+            }
+
+            if(ch == '\\'){
+                ch = _in.get();
+                if(!_in.good()){
+                    return std::nullopt;
+                }
+                ch = unescapeChar(ch);
+            }
+
+            value.push_back(ch);
+        }
+    }
+
     std::optional<Cell> parseInput(std::istream &_in, bool quoted)
     {
         while(isspace(_in.get()));
@@ -122,6 +164,10 @@ namespace lisp
             return std::nullopt;
         }
 
+        if(_in.peek() == '"'){
+            return parseText(_in);
+        }
+
         if(_in.peek() == '\''){
             _in.get();
 
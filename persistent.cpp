@@ -0,0 +1,809 @@
+#include "lisp.h"
+#include "persistent.h"
+#include <atomic>
+#include <limits>
+
+namespace lisp
+{
+    static constexpr unsigned hashBits = std::numeric_limits<std::size_t>::digits;
+
+    static std::uint64_t newEdit()
+    {
+        static std::atomic<std::uint64_t> last{0};
+        return ++last;
+    }
+
+    // _node itself when the builder _edit made it, otherwise a copy that it owns
+    template<typename Node>
+    static std::shared_ptr<Node> editable(const std::shared_ptr<Node> &_node, std::uint64_t _edit)
+    {
+        if(_edit && _node->edit == _edit){
+            return _node;
+        }
+
+        auto copy = std::make_shared<Node>(*_node);
+        copy->edit = _edit;
+        return copy;
+    }
+
+    // Vector
+
+    static const PtrVectorNode &emptyVectorNode()
+    {
+        static const auto node = std::make_shared<VectorNode>();
+        return node;
+    }
+
+    Vector::Vector() : root(emptyVectorNode()), tail(emptyVectorNode()) {}
+
+    const VectorNode &Vector::leafFor(std::size_t _i) const
+    {
+        if(_i >= tailOffset()){
+            return *tail;
+        }
+
+        auto node = root.get();
+        for(auto level = shift; level > 0; level -= 5){
+            node = node->children[(_i >> level) & 31].get();
+        }
+        return *node;
+    }
+
+    const Cell &Vector::at(std::size_t _i) const
+    {
+        return leafFor(_i).values[_i & 31];
+    }
+
+    // a chain of single child nodes from _level down to _leaf
+    static PtrVectorNode newPath(unsigned _level, const PtrVectorNode &_leaf, std::uint64_t _edit)
+    {
+        if(_level == 0){
+            return _leaf;
+        }
+
+        auto node = std::make_shared<VectorNode>();
+        node->edit = _edit;
+        node->children.push_back(newPath(_level - 5, _leaf, _edit));
+        return node;
+    }
+
+    // hangs the full _leaf after the last leaf of the tree, _count is the size before the push
+    static PtrVectorNode pushLeaf(std::size_t _count, unsigned _level, const PtrVectorNode &_parent,
+                                  const PtrVectorNode &_leaf, std::uint64_t _edit)
+    {
+        auto node = editable(_parent, _edit);
+        auto sub = ((_count - 1) >> _level) & 31;
+
+        PtrVectorNode child;
+        if(_level == 5){
+            child = _leaf;
+        }
+        else if(sub < node->children.size()){
+            child = pushLeaf(_count, _level - 5, node->children[sub], _leaf, _edit);
+        }
+        else{
+            child = newPath(_level - 5, _leaf, _edit);
+        }
+
+        if(sub < node->children.size()){
+            node->children[sub] = std::move(child);
+        }
+        else{
+            node->children.push_back(std::move(child));
+        }
+        return node;
+    }
+
+    void Vector::pushIn(Cell _value, std::uint64_t _edit)
+    {
+        if(count - tailOffset() < 32){
+            tail = editable(tail, _edit);
+            tail->values.push_back(std::move(_value));
+            count++;
+            return;
+        }
+
+        // the tail is full, it moves into the tree and a new level is added once the root is full
+        if((count >> 5) > (std::size_t(1) << shift)){
+            auto node = std::make_shared<VectorNode>();
+            node->edit = _edit;
+            node->children = {root, newPath(shift, tail, _edit)};
+            root = std::move(node);
+            shift += 5;
+        }
+        else{
+            root = pushLeaf(count, shift, root, tail, _edit);
+        }
+
+        tail = std::make_shared<VectorNode>();
+        tail->edit = _edit;
+        tail->values.reserve(32);
+        tail->values.push_back(std::move(_value));
+        count++;
+    }
+
+    Vector Vector::push(Cell _value) const
+    {
+        auto copy = *this;
+        copy.pushIn(std::move(_value), 0);
+        return copy;
+    }
+
+    static PtrVectorNode setPath(unsigned _level, const PtrVectorNode &_node, std::size_t _i, Cell &&_value)
+    {
+        auto node = editable(_node, 0);
+        if(_level == 0){
+            node->values[_i & 31] = std::move(_value);
+        }
+        else{
+            auto &child = node->children[(_i >> _level) & 31];
+            child = setPath(_level - 5, child, _i, std::move(_value));
+        }
+        return node;
+    }
+
+    Vector Vector::set(std::size_t _i, Cell _value) const
+    {
+        auto copy = *this;
+        if(_i >= tailOffset()){
+            copy.tail = editable(tail, 0);
+            copy.tail->values[_i & 31] = std::move(_value);
+        }
+        else{
+            copy.root = setPath(shift, root, _i, std::move(_value));
+        }
+        return copy;
+    }
+
+    // drops the last leaf of the tree, nullptr when _node is left empty
+    static PtrVectorNode popLeaf(std::size_t _count, unsigned _level, const PtrVectorNode &_node)
+    {
+        auto sub = ((_count - 2) >> _level) & 31;
+
+        if(_level > 5){
+            auto child = popLeaf(_count, _level - 5, _node->children[sub]);
+            if(!child && sub == 0){
+                return nullptr;
+            }
+
+            auto node = editable(_node, 0);
+            if(child){
+                node->children[sub] = std::move(child);
+            }
+            else{
+                node->children.pop_back();
+            }
+            return node;
+        }
+
+        if(sub == 0){
+            return nullptr;
+        }
+
+        auto node = editable(_node, 0);
+        node->children.pop_back();
+        return node;
+    }
+
+    Vector Vector::pop() const
+    {
+        if(count <= 1){
+            return Vector();
+        }
+
+        auto copy = *this;
+        copy.count--;
+
+        if(count - tailOffset() > 1){
+            copy.tail = editable(tail, 0);
+            copy.tail->values.pop_back();
+            return copy;
+        }
+
+        // the last leaf of the tree becomes the tail
+        auto &leaf = leafFor(count - 2);
+        copy.tail = std::make_shared<VectorNode>(leaf);
+        copy.tail->edit = 0;
+
+        auto node = popLeaf(count, shift, root);
+        if(!node){
+            node = emptyVectorNode();
+        }
+        if(shift > 5 && node->children.size() == 1){
+            node = node->children.front();
+            copy.shift -= 5;
+        }
+        copy.root = std::move(node);
+        return copy;
+    }
+
+    bool Vector::operator==(const Vector &_v) const
+    {
+        if(count != _v.count){
+            return false;
+        }
+
+        for(std::size_t i = 0; i < count; i += 32){
+            auto &a = leafFor(i), &b = _v.leafFor(i);
+            if(&a != &b && a.values != b.values){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    VectorBuilder::VectorBuilder() : edit(newEdit()) {}
+
+    VectorBuilder::VectorBuilder(const Vector &_vector) : vector(_vector), edit(newEdit()) {}
+
+    void VectorBuilder::push(Cell _value)
+    {
+        vector.pushIn(std::move(_value), edit);
+    }
+
+    Vector VectorBuilder::build()
+    {
+        edit = newEdit();
+        return vector;
+    }
+
+    // Map
+
+    static const PtrMapNode &emptyMapNode()
+    {
+        static const auto node = std::make_shared<MapNode>();
+        return node;
+    }
+
+    static std::size_t chunkOf(std::size_t _hash, unsigned _shift)
+    {
+        return (_hash >> _shift) & 31;
+    }
+
+    // position of the slot _bit among the taken slots of _map
+    static std::size_t rankOf(std::uint32_t _map, std::uint32_t _bit)
+    {
+        return __builtin_popcount(_map & (_bit - 1));
+    }
+
+    Map::Map() : root(emptyMapNode()) {}
+
+    const Cell *Map::find(const Cell &_key) const
+    {
+        auto hash = hashCell(_key);
+        auto node = root.get();
+
+        for(unsigned shift = 0; shift < hashBits; shift += 5){
+            std::uint32_t bit = 1u << chunkOf(hash, shift);
+
+            if(node->datamap & bit){
+                auto &entry = node->entries[rankOf(node->datamap, bit)];
+                return entry.first == _key ? &entry.second : nullptr;
+            }
+            if(!(node->nodemap & bit)){
+                return nullptr;
+            }
+
+            node = node->children[rankOf(node->nodemap, bit)].get();
+        }
+
+        for(auto &entry : node->entries){
+            if(entry.first == _key){
+                return &entry.second;
+            }
+        }
+        return nullptr;
+    }
+
+    using Entry = std::pair<Cell, Cell>;
+
+    // a node holding two entries that share the hash bits below _shift
+    static PtrMapNode mergeEntries(Entry &&_a, std::size_t _hashA, Entry &&_b, std::size_t _hashB,
+                                   unsigned _shift, std::uint64_t _edit)
+    {
+        auto node = std::make_shared<MapNode>();
+        node->edit = _edit;
+
+        if(_shift >= hashBits){
+            node->entries.push_back(std::move(_a));
+            node->entries.push_back(std::move(_b));
+            return node;
+        }
+
+        auto a = chunkOf(_hashA, _shift), b = chunkOf(_hashB, _shift);
+        if(a == b){
+            node->nodemap = 1u << a;
+            node->children.push_back(mergeEntries(std::move(_a), _hashA, std::move(_b), _hashB, _shift + 5, _edit));
+            return node;
+        }
+
+        node->datamap = (1u << a) | (1u << b);
+        if(a > b){
+            std::swap(_a, _b);
+        }
+        node->entries.push_back(std::move(_a));
+        node->entries.push_back(std::move(_b));
+        return node;
+    }
+
+    static PtrMapNode setEntry(const PtrMapNode &_node, Cell &&_key, Cell &&_value, std::size_t _hash,
+                               unsigned _shift, std::uint64_t _edit, bool &_added)
+    {
+        if(_shift >= hashBits){
+            auto node = editable(_node, _edit);
+            for(auto &entry : node->entries){
+                if(entry.first == _key){
+                    entry.second = std::move(_value);
+                    return node;
+                }
+            }
+
+            node->entries.emplace_back(std::move(_key), std::move(_value));
+            _added = true;
+            return node;
+        }
+
+        std::uint32_t bit = 1u << chunkOf(_hash, _shift);
+
+        if(_node->datamap & bit){
+            auto i = rankOf(_node->datamap, bit);
+            auto node = editable(_node, _edit);
+
+            if(node->entries[i].first == _key){
+                node->entries[i].second = std::move(_value);
+                return node;
+            }
+
+            // two keys in one slot move down into a child
+            auto other = std::move(node->entries[i]);
+            auto otherHash = hashCell(other.first);
+            node->entries.erase(node->entries.begin() + i);
+            node->datamap ^= bit;
+            node->nodemap |= bit;
+            node->children.insert(node->children.begin() + rankOf(node->nodemap, bit),
+                mergeEntries(std::move(other), otherHash, {std::move(_key), std::move(_value)}, _hash, _shift + 5, _edit));
+
+            _added = true;
+            return node;
+        }
+
+        if(_node->nodemap & bit){
+            auto i = rankOf(_node->nodemap, bit);
+            auto &child = _node->children[i];
+            auto changed = setEntry(child, std::move(_key), std::move(_value), _hash, _shift + 5, _edit, _added);
+            if(changed == child){
+                return _node;
+            }
+
+            auto node = editable(_node, _edit);
+            node->children[i] = std::move(changed);
+            return node;
+        }
+
+        auto node = editable(_node, _edit);
+        node->entries.insert(node->entries.begin() + rankOf(node->datamap, bit), {std::move(_key), std::move(_value)});
+        node->datamap |= bit;
+        _added = true;
+        return node;
+    }
+
+    void Map::setIn(Cell _key, Cell _value, std::uint64_t _edit)
+    {
+        bool added = false;
+        auto hash = hashCell(_key);
+        root = setEntry(root, std::move(_key), std::move(_value), hash, 0, _edit, added);
+        count += added;
+    }
+
+    Map Map::set(Cell _key, Cell _value) const
+    {
+        auto copy = *this;
+        copy.setIn(std::move(_key), std::move(_value), 0);
+        return copy;
+    }
+
+    static PtrMapNode removeEntry(const PtrMapNode &_node, const Cell &_key, std::size_t _hash,
+                                  unsigned _shift, bool &_removed)
+    {
+        if(_shift >= hashBits){
+            for(std::size_t i = 0; i < _node->entries.size(); i++){
+                if(_node->entries[i].first == _key){
+                    auto node = editable(_node, 0);
+                    node->entries.erase(node->entries.begin() + i);
+                    _removed = true;
+                    return node;
+                }
+            }
+            return _node;
+        }
+
+        std::uint32_t bit = 1u << chunkOf(_hash, _shift);
+
+        if(_node->datamap & bit){
+            auto i = rankOf(_node->datamap, bit);
+            if(_node->entries[i].first != _key){
+                return _node;
+            }
+
+            auto node = editable(_node, 0);
+            node->entries.erase(node->entries.begin() + i);
+            node->datamap ^= bit;
+            _removed = true;
+            return node;
+        }
+
+        if(_node->nodemap & bit){
+            auto i = rankOf(_node->nodemap, bit);
+            auto child = removeEntry(_node->children[i], _key, _hash, _shift + 5, _removed);
+            if(!_removed){
+                return _node;
+            }
+
+            auto node = editable(_node, 0);
+
+            // a child left with one entry is folded back into this node
+            if(child->children.empty() && child->entries.size() == 1){
+                node->children.erase(node->children.begin() + i);
+                node->nodemap ^= bit;
+                node->entries.insert(node->entries.begin() + rankOf(node->datamap, bit), child->entries.front());
+                node->datamap |= bit;
+            }
+            else{
+                node->children[i] = std::move(child);
+            }
+            return node;
+        }
+
+        return _node;
+    }
+
+    Map Map::remove(const Cell &_key) const
+    {
+        bool removed = false;
+        auto node = removeEntry(root, _key, hashCell(_key), 0, removed);
+        if(!removed){
+            return *this;
+        }
+
+        auto copy = *this;
+        copy.root = std::move(node);
+        copy.count--;
+        return copy;
+    }
+
+    static void visitEntries(const MapNode &_node, const std::function<void (const Cell &, const Cell &)> &_f)
+    {
+        for(auto &entry : _node.entries){
+            _f(entry.first, entry.second);
+        }
+        for(auto &child : _node.children){
+            visitEntries(*child, _f);
+        }
+    }
+
+    void Map::forEach(const std::function<void (const Cell &, const Cell &)> &_f) const
+    {
+        visitEntries(*root, _f);
+    }
+
+    bool Map::operator==(const Map &_m) const
+    {
+        if(count != _m.count){
+            return false;
+        }
+        if(root == _m.root){
+            return true;
+        }
+
+        bool same = true;
+        forEach([&](const Cell &_key, const Cell &_value)
+            {
+                if(same){
+                    auto value = _m.find(_key);
+                    same = value && *value == _value;
+                }
+            }
+        );
+        return same;
+    }
+
+    MapBuilder::MapBuilder() : edit(newEdit()) {}
+
+    MapBuilder::MapBuilder(const Map &_map) : map(_map), edit(newEdit()) {}
+
+    void MapBuilder::set(Cell _key, Cell _value)
+    {
+        map.setIn(std::move(_key), std::move(_value), edit);
+    }
+
+    Map MapBuilder::build()
+    {
+        edit = newEdit();
+        return map;
+    }
+
+    // spreads the bits of std::hash, which is the identity for integers
+    static std::size_t mixHash(std::uint64_t _h)
+    {
+        _h ^= _h >> 30;
+        _h *= 0xbf58476d1ce4e5b9;
+        _h ^= _h >> 27;
+        _h *= 0x94d049bb133111eb;
+        _h ^= _h >> 31;
+        return std::size_t(_h);
+    }
+
+    std::size_t hashCell(const Cell &_cell)
+    {
+        std::size_t hash = 0;
+
+        _cell.visit(
+            [&hash](auto &_value){
+                using T = std::decay_t<decltype(_value)>;
+                if constexpr(std::is_same_v<T, BigInt>){
+                    hash = std::hash<std::string>()(_value.toString());
+                }
+                else if constexpr(std::is_same_v<T, Quotation> || std::is_same_v<T, String>){
+                    hash = std::hash<std::string>()(_value.str());
+                }
+                else if constexpr(std::is_same_v<T, List>){
+                    for(auto &cell : _value){
+                        hash = hash * 31 + hashCell(cell);
+                    }
+                }
+                else if constexpr(std::is_same_v<T, Vector>){
+                    for(std::size_t i = 0; i < _value.size(); i++){
+                        hash = hash * 31 + hashCell(_value.at(i));
+                    }
+                }
+                else if constexpr(std::is_same_v<T, Map>){
+                    // independent of the order entries are visited in
+                    _value.forEach([&hash](const Cell &_key, const Cell &_entry)
+                        {
+                            hash += mixHash(hashCell(_key) * 31 + hashCell(_entry));
+                        }
+                    );
+                }
+                else{
+                    hash = std::hash<T>()(_value);
+                }
+            }
+        );
+
+        return mixHash(hash);
+    }
+
+    static const Vector *vectorOf(const Cell &_cell, const char *_name)
+    {
+        if(!_cell.isType<Vector>()){
+            std::cerr << _name << ": need a vector" << std::endl;
+            return nullptr;
+        }
+        return &_cell.ref<Vector>();
+    }
+
+    static const Map *mapOf(const Cell &_cell, const char *_name)
+    {
+        if(!_cell.isType<Map>()){
+            std::cerr << _name << ": need a map" << std::endl;
+            return nullptr;
+        }
+        return &_cell.ref<Map>();
+    }
+
+    static bool indexIn(const Cell &_cell, std::size_t _size, const char *_name)
+    {
+        if(!_cell.isType<Int>() || _cell.get<Int>() < 0 || std::size_t(_cell.get<Int>()) >= _size){
+            std::cerr << _name << ": index out of range" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // (vector <x> ...)
+    std::optional<Cell> buildinVector(Args _args, PtrEnvir &)
+    {
+        VectorBuilder builder;
+        for(auto &cell : _args){
+            builder.push(cell);
+        }
+
+        return builder.build();
+    }
+
+    std::optional<Cell> buildinListToVector(Args _args, PtrEnvir &)
+    {
+        if(_args.size() != 1 || !_args.front().isType<List>()){
+            std::cerr << "list->vector: need a list" << std::endl;
+            return std::nullopt;
+        }
+
+        VectorBuilder builder;
+        for(auto &cell : _args.front().ref<List>()){
+            builder.push(cell);
+        }
+
+        return builder.build();
+    }
+
+    std::optional<Cell> buildinVectorToList(Args _args, PtrEnvir &)
+    {
+        auto vector = _args.size() == 1 ? vectorOf(_args.front(), "vector->list") : nullptr;
+        if(!vector){
+            return std::nullopt;
+        }
+
+        List list;
+        for(std::size_t i = 0; i < vector->size(); i++){
+            list.push_back(vector->at(i));
+        }
+
+        return list;
+    }
+
+    std::optional<Cell> buildinVectorLength(Args _args, PtrEnvir &)
+    {
+        auto vector = _args.size() == 1 ? vectorOf(_args.front(), "vector-length") : nullptr;
+        if(!vector){
+            return std::nullopt;
+        }
+
+        return Int(vector->size());
+    }
+
+    // (vector-ref <vector> <i>)
+    std::optional<Cell> buildinVectorRef(Args _args, PtrEnvir &)
+    {
+        auto vector = _args.size() == 2 ? vectorOf(_args.front(), "vector-ref") : nullptr;
+        if(!vector || !indexIn(_args.back(), vector->size(), "vector-ref")){
+            return std::nullopt;
+        }
+
+        return vector->at(_args.back().get<Int>());
+    }
+
+    // (vector-set <vector> <i> <x>) => a new vector
+    std::optional<Cell> buildinVectorSet(Args _args, PtrEnvir &)
+    {
+        auto vector = _args.size() == 3 ? vectorOf(_args.front(), "vector-set") : nullptr;
+        if(!vector){
+            return std::nullopt;
+        }
+
+        auto &index = *std::next(_args.begin());
+        if(!indexIn(index, vector->size(), "vector-set")){
+            return std::nullopt;
+        }
+
+        return vector->set(index.get<Int>(), _args.back());
+    }
+
+    // (vector-push <vector> <x>) => a new vector one longer
+    std::optional<Cell> buildinVectorPush(Args _args, PtrEnvir &)
+    {
+        auto vector = _args.size() == 2 ? vectorOf(_args.front(), "vector-push") : nullptr;
+        if(!vector){
+            return std::nullopt;
+        }
+
+        return vector->push(_args.back());
+    }
+
+    // (vector-pop <vector>) => a new vector without the last element
+    std::optional<Cell> buildinVectorPop(Args _args, PtrEnvir &)
+    {
+        auto vector = _args.size() == 1 ? vectorOf(_args.front(), "vector-pop") : nullptr;
+        if(!vector){
+            return std::nullopt;
+        }
+        if(vector->size() == 0){
+            std::cerr << "vector-pop: empty vector" << std::endl;
+            return std::nullopt;
+        }
+
+        return vector->pop();
+    }
+
+    // (hash-map <key> <value> ...)
+    std::optional<Cell> buildinHashMap(Args _args, PtrEnvir &)
+    {
+        if(_args.size() % 2 != 0){
+            std::cerr << "hash-map: need keys and values in pairs" << std::endl;
+            return std::nullopt;
+        }
+
+        MapBuilder builder;
+        for(auto it = _args.begin(); it != _args.end(); it++){
+            auto &key = *it++;
+            builder.set(key, *it);
+        }
+
+        return builder.build();
+    }
+
+    // (list->map ((<key> <value>) ...))
+    std::optional<Cell> buildinListToMap(Args _args, PtrEnvir &)
+    {
+        if(_args.size() != 1 || !_args.front().isType<List>()){
+            std::cerr << "list->map: need a list" << std::endl;
+            return std::nullopt;
+        }
+
+        MapBuilder builder;
+        for(auto &entry : _args.front().ref<List>()){
+            if(!entry.isType<List>() || entry.ref<List>().size() != 2){
+                std::cerr << "list->map: entries are (key value) lists" << std::endl;
+                return std::nullopt;
+            }
+
+            builder.set(entry.ref<List>().front(), entry.ref<List>().back());
+        }
+
+        return builder.build();
+    }
+
+    std::optional<Cell> buildinMapToList(Args _args, PtrEnvir &)
+    {
+        auto map = _args.size() == 1 ? mapOf(_args.front(), "map->list") : nullptr;
+        if(!map){
+            return std::nullopt;
+        }
+
+        List list;
+        map->forEach([&list](const Cell &_key, const Cell &_value)
+            {
+                list.push_back(List{_key, _value});
+            }
+        );
+
+        return list;
+    }
+
+    std::optional<Cell> buildinMapCount(Args _args, PtrEnvir &)
+    {
+        auto map = _args.size() == 1 ? mapOf(_args.front(), "map-count") : nullptr;
+        if(!map){
+            return std::nullopt;
+        }
+
+        return Int(map->size());
+    }
+
+    // (map-ref <map> <key> [<default>]), false for a missing key without a default
+    std::optional<Cell> buildinMapRef(Args _args, PtrEnvir &)
+    {
+        auto map = _args.size() == 2 || _args.size() == 3 ? mapOf(_args.front(), "map-ref") : nullptr;
+        if(!map){
+            return std::nullopt;
+        }
+
+        auto value = map->find(*std::next(_args.begin()));
+        if(value){
+            return *value;
+        }
+
+        return _args.size() == 3 ? _args.back() : Cell(false);
+    }
+
+    // (map-set <map> <key> <value>) => a new map
+    std::optional<Cell> buildinMapSet(Args _args, PtrEnvir &)
+    {
+        auto map = _args.size() == 3 ? mapOf(_args.front(), "map-set") : nullptr;
+        if(!map){
+            return std::nullopt;
+        }
+
+        return map->set(*std::next(_args.begin()), _args.back());
+    }
+
+    // (map-remove <map> <key>) => a new map
+    std::optional<Cell> buildinMapRemove(Args _args, PtrEnvir &)
+    {
+        auto map = _args.size() == 2 ? mapOf(_args.front(), "map-remove") : nullptr;
+        if(!map){
+            return std::nullopt;
+        }
+
+        return map->remove(_args.back());
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include "lispbase.h"
+#include <cstdint>
+
+namespace lisp
+{
+    // Nodes are shared between versions and never change once a Vector or Map holds them.
+    // A builder owns the nodes it made, tagged with its edit token, and updates those in place.
+
+    struct VectorNode{
+        std::vector<PtrVectorNode> children;    // inner nodes
+        std::vector<Cell> values;               // leaves
+        std::uint64_t edit = 0;
+    };
+
+    // bitmaps say which of the 32 slots of a level hold an entry and which a child,
+    // nodes past the last hash bits hold colliding entries in a plain list
+    struct MapNode{
+        std::uint32_t datamap = 0, nodemap = 0;
+        std::vector<std::pair<Cell, Cell>> entries;
+        std::vector<PtrMapNode> children;
+        std::uint64_t edit = 0;
+    };
+
+    // a transient vector, pushing in place until it is built
+    class VectorBuilder{
+        private:
+            Vector vector;
+            std::uint64_t edit;
+
+        public:
+            VectorBuilder();
+            explicit VectorBuilder(const Vector &_vector);
+            void push(Cell _value);
+            // later pushes copy instead of changing the result
+            Vector build();
+    };
+
+    class MapBuilder{
+        private:
+            Map map;
+            std::uint64_t edit;
+
+        public:
+            MapBuilder();
+            explicit MapBuilder(const Map &_map);
+            void set(Cell _key, Cell _value);
+            Map build();
+    };
+
+    // consistent with Cell::operator==
+    std::size_t hashCell(const Cell &_cell);
+}
@@ -0,0 +1,261 @@
+#include "lisp.h"
+#include "reader.h"
+#include <cctype>
+
+namespace lisp
+{
+    FormReader::FormReader(const std::string &_path, std::uint64_t _offset)
+    : file(std::fopen(_path.c_str(), "rb")), buffer(bufferSize), base(_offset)
+    {
+        if(!file){
+            std::cerr << "reader: cannot open " << _path << std::endl;
+            return;
+        }
+
+        if(_offset && std::fseek(file, long(_offset), SEEK_SET) != 0){
+            std::cerr << "reader: cannot seek to " << _offset << std::endl;
+            failed = true;
+        }
+
+        start = stop = _offset;
+    }
+
+    std::shared_ptr<FormReader> FormReader::fromText(const std::string &_text)
+    {
+        std::shared_ptr<FormReader> reader(new FormReader());
+        reader->memory = true;
+        reader->buffer.assign(_text.begin(), _text.end());
+        reader->filled = _text.size();
+        return reader;
+    }
+
+    FormReader::~FormReader()
+    {
+        if(file){
+            std::fclose(file);
+        }
+    }
+
+    int FormReader::peek()
+    {
+        if(pos == filled){
+            if(memory){
+                return EOF;
+            }
+
+            base += filled;
+            pos = 0;
+            filled = std::fread(buffer.data(), 1, buffer.size(), file);
+
+            if(filled == 0){
+                return EOF;
+            }
+        }
+
+        return static_cast<unsigned char>(buffer[pos]);
+    }
+
+    int FormReader::get()
+    {
+        auto ch = peek();
+        if(ch != EOF){
+            pos++;
+        }
+        return ch;
+    }
+
+    std::optional<Cell> FormReader::parseToken()
+    {
+        std::string token;
+        while(peek() != EOF && isLegalChar(char(peek()))){
+            token.push_back(char(get()));
+        }
+
+        auto number = parseNumber(token);
+        if(number){
+            return number;
+        }
+
+        if(token == "true" || token == "false"){
+            return token == "true";
+        }
+
+        return Quotation(token);
+    }
+
+    std::optional<Cell> FormReader::parseText()
+    {
+        std::string text;
+        get();
+
+        while(true){
+            auto ch = get();
+
+            if(ch == EOF){
+                return std::nullopt;
+            }
+
+            if(ch == '"'){
+                return String(std::move(text));
+            }
+
+            if(ch == '\\'){
+                ch = get();
+                if(ch == EOF){
+                    return std::nullopt;
+                }
+                ch = unescapeChar(char(ch));
+            }
+
+            text.push_back(char(ch));
+        }
+    }
+
+    std::optional<Cell> FormReader::next()
+    {
+        if(!good()){
+            return std::nullopt;
+        }
+
+        // lists still open, innermost last
+        std::vector<List> open;
+
+        while(true){
+            auto ch = peek();
+
+            if(ch == EOF){
+                if(!open.empty()){
+                    std::cerr << "reader: unterminated form at " << start << std::endl;
+                    failed = true;
+                }
+                ended = !failed;
+                return std::nullopt;
+            }
+
+            if(isspace(ch)){
+                get();
+                continue;
+            }
+
+            if(open.empty()){
+                start = tell();
+            }
+
+            std::optional<Cell> cell;
+
+            if(ch == '('){
+                get();
+                open.emplace_back();
+                continue;
+            }
+            else if(ch == ')'){
+                get();
+                if(open.empty()){
+                    std::cerr << "reader: unexpected ) at " << start << std::endl;
+                    failed = true;
+                    return std::nullopt;
+                }
+
+                cell = std::move(open.back());
+                open.pop_back();
+            }
+            else if(ch == '"'){
+                cell = parseText();
+                if(!cell){
+                    std::cerr << "reader: unterminated string at " << start << std::endl;
+                    failed = true;
+                    return std::nullopt;
+                }
+            }
+            else if(isLegalChar(char(ch))){
+                cell = parseToken();
+            }
+            else{
+                std::cerr << "reader: unexpected " << char(ch) << " at " << tell() << std::endl;
+                failed = true;
+                return std::nullopt;
+            }
+
+            if(open.empty()){
+                stop = tell();
+                return cell;
+            }
+
+            open.back().push_back(std::move(cell.value()));
+        }
+    }
+
+    static FormReader *readerOf(const Cell &_cell, const char *_name)
+    {
+        if(_cell.isType<PtrObject>()){
+            if(auto reader = dynamic_cast<FormReader *>(_cell.ref<PtrObject>().get())){
+                return reader;
+            }
+        }
+
+        std::cerr << _name << ": need a reader" << std::endl;
+        return nullptr;
+    }
+
+    std::optional<Cell> buildinOpenReader(Args _args, PtrEnvir &)
+    {
+        if(_args.empty() || _args.size() > 2){
+            std::cerr << "open-reader: need a path and an optional offset" << std::endl;
+            return std::nullopt;
+        }
+
+        auto path = pathOf(_args.front());
+        if(!path || (_args.size() == 2 && !(_args.back().isType<Int>() && _args.back().get<Int>() >= 0))){
+            std::cerr << "open-reader: invalid path or offset" << std::endl;
+            return std::nullopt;
+        }
+
+        auto offset = _args.size() == 2 ? std::uint64_t(_args.back().get<Int>()) : 0;
+        auto reader = std::make_shared<FormReader>(path.value(), offset);
+        if(!reader->good()){
+            return std::nullopt;
+        }
+
+        return Cell(PtrObject(reader));
+    }
+
+    std::optional<Cell> buildinReadNext(Args _args, PtrEnvir &)
+    {
+        auto reader = _args.size() == 1 ? readerOf(_args.front(), "read-next") : nullptr;
+        if(!reader){
+            return std::nullopt;
+        }
+
+        auto form = reader->next();
+        if(!form){
+            // a malformed form is an error, the end of the file is false, see reader-done?
+            if(!reader->good()){
+                return std::nullopt;
+            }
+            return false;
+        }
+
+        return form;
+    }
+
+    // (reader-done? <reader>) is true once read-next has returned the end of the file
+    std::optional<Cell> buildinReaderDone(Args _args, PtrEnvir &)
+    {
+        auto reader = _args.size() == 1 ? readerOf(_args.front(), "reader-done?") : nullptr;
+        if(!reader){
+            return std::nullopt;
+        }
+
+        return reader->done();
+    }
+
+    std::optional<Cell> buildinReaderOffset(Args _args, PtrEnvir &)
+    {
+        auto reader = _args.size() == 1 ? readerOf(_args.front(), "reader-offset") : nullptr;
+        if(!reader){
+            return std::nullopt;
+        }
+
+        return Int(reader->formStart());
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include "lispbase.h"
+#include <cstdint>
+#include <cstdio>
+
+namespace lisp
+{
+    // Reads the top-level forms of a data file one at a time through a fixed buffer,
+    // so memory stays bounded by the largest form rather than the file.
+    // Forms are data: numbers and strings stay as they are, true and false are bools
+    // and other symbols become Quotation.
+    // In lisp, (read-next r) gives the next form and false at the end, which a false form also
+    // reads as, so loops test (reader-done? r) after each read to tell the two apart.
+    class FormReader : public Object{
+        private:
+            FormReader() = default;
+            static constexpr std::size_t bufferSize = 1 << 16;
+
+            std::FILE *file = nullptr;
+            // the whole input when reading from memory
+            bool memory = false;
+            std::vector<char> buffer;
+            std::size_t pos = 0, filled = 0;
+            // offset of buffer[0] in the file
+            std::uint64_t base = 0;
+            std::uint64_t start = 0, stop = 0;
+            bool failed = false;
+            bool ended = false;
+
+            int peek();
+            int get();
+            std::uint64_t tell() const {return base + pos;}
+            std::optional<Cell> parseToken();
+            std::optional<Cell> parseText();
+
+        public:
+            // starts at _offset, which should be the start of a form or the whitespace before it
+            explicit FormReader(const std::string &_path, std::uint64_t _offset = 0);
+            // forms from text in memory
+            static std::shared_ptr<FormReader> fromText(const std::string &_text);
+            ~FormReader();
+            FormReader(const FormReader &) = delete;
+            FormReader &operator=(const FormReader &) = delete;
+
+            const char *typeName() const override {return "Reader";}
+            bool good() const {return (file || memory) && !failed;}
+            // next() reached the end of the input after its last form
+            bool done() const {return ended;}
+            // std::nullopt at the end of the file or on a malformed form, see good()
+            std::optional<Cell> next();
+            // byte range of the last form read, for splitting a file into shards
+            std::uint64_t formStart() const {return start;}
+            std::uint64_t formEnd() const {return stop;}
+
+            class Iterator{
+                private:
+                    FormReader *reader;
+                    std::optional<Cell> form;
+
+                public:
+                    explicit Iterator(FormReader *_reader) : reader(_reader)
+                    {if(reader) ++*this;}
+                    const Cell &operator*() const {return form.value();}
+                    const Cell *operator->() const {return &form.value();}
+                    Iterator &operator++()
+                    {form = reader->next(); if(!form) reader = nullptr; return *this;}
+                    bool operator!=(const Iterator &_it) const {return reader != _it.reader;}
+                    bool operator==(const Iterator &_it) const {return reader == _it.reader;}
+            };
+
+            // single pass, for(auto &form : reader)
+            Iterator begin() {return Iterator(this);}
+            Iterator end() {return Iterator(nullptr);}
+    };
+    using PtrReader = std::shared_ptr<FormReader>;
+}
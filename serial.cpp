@@ -0,0 +1,643 @@
+#include "lisp.h"
+#include "reader.h"
+#include "serial.h"
+#include "persistent.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+
+namespace lisp
+{
+    static void writeInt(Int _i, std::string &_out)
+    {
+        char text[24];
+        auto end = std::to_chars(text, text + sizeof(text), _i).ptr;
+        _out.append(text, end);
+    }
+
+    // the shortest text that reads back as the same double, always with a point or exponent
+    static bool writeFloat(double _f, std::string &_out)
+    {
+        if(!std::isfinite(_f)){
+            std::cerr << "serial: cannot write " << _f << std::endl;
+            return false;
+        }
+
+        char text[32];
+        auto end = std::to_chars(text, text + sizeof(text), _f).ptr;
+        _out.append(text, end);
+
+        if(std::string_view(text, end - text).find_first_of(".e") == std::string_view::npos){
+            _out += ".0";
+        }
+        return true;
+    }
+
+    // a list or vector being written and the next element to write
+    struct Frame{
+        List::const_iterator it, end;
+        const Vector *vector = nullptr;
+        std::size_t next = 0;
+
+        bool done() const {return vector ? next == vector->size() : it == end;}
+        const Cell *advance() {return vector ? &vector->at(next++) : &*it++;}
+    };
+
+    // S-expression
+
+    static void writeSexprString(const std::string &_s, std::string &_out)
+    {
+        _out += '"';
+        for(char c : _s){
+            switch(c){
+                case '"': _out += "\\\""; break;
+                case '\\': _out += "\\\\"; break;
+                case '\n': _out += "\\n"; break;
+                case '\t': _out += "\\t"; break;
+                case '\r': _out += "\\r"; break;
+                case '\0': _out += "\\0"; break;
+                default: _out += c;
+            }
+        }
+        _out += '"';
+    }
+
+    // symbols that would read back as something else are refused
+    static bool writeSymbol(const std::string &_s, std::string &_out)
+    {
+        bool legal = !_s.empty() && std::all_of(_s.begin(), _s.end(), isLegalChar);
+        if(!legal || parseNumber(_s) || _s == "true" || _s == "false"){
+            std::cerr << "write-sexpr: symbol " << _s << " would not read back" << std::endl;
+            return false;
+        }
+
+        _out += _s;
+        return true;
+    }
+
+    static bool writeSexprAtom(const Cell &_cell, std::string &_out)
+    {
+        if(_cell.isType<bool>()){
+            _out += _cell.get<bool>() ? "true" : "false";
+        }
+        else if(_cell.isType<Int>()){
+            writeInt(_cell.get<Int>(), _out);
+        }
+        else if(_cell.isType<BigInt>()){
+            _out += _cell.ref<BigInt>().toString();
+        }
+        else if(_cell.isType<double>()){
+            return writeFloat(_cell.get<double>(), _out);
+        }
+        else if(_cell.isType<String>()){
+            writeSexprString(_cell.ref<String>().str(), _out);
+        }
+        else if(_cell.isType<Quotation>()){
+            return writeSymbol(_cell.ref<Quotation>().str(), _out);
+        }
+        else if(_cell.isType<std::string>()){
+            return writeSymbol(_cell.ref<std::string>(), _out);
+        }
+        else{
+            std::cerr << "write-sexpr: value has no text" << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    bool writeSexpr(const Cell &_cell, std::string &_out)
+    {
+        std::vector<Frame> stack;
+        const Cell *cell = &_cell;
+
+        while(true){
+            if(cell){
+                if(cell->isType<List>()){
+                    auto &list = cell->ref<List>();
+                    _out += '(';
+                    stack.push_back({list.begin(), list.end()});
+                }
+                else if(cell->isType<Vector>()){
+                    _out += "(vector";
+                    stack.push_back({List::const_iterator(), List::const_iterator(), &cell->ref<Vector>()});
+                }
+                else if(!writeSexprAtom(*cell, _out)){
+                    return false;
+                }
+            }
+
+            if(stack.empty()){
+                return true;
+            }
+
+            auto &top = stack.back();
+            if(top.done()){
+                _out += ')';
+                stack.pop_back();
+                cell = nullptr;
+                continue;
+            }
+
+            if(_out.back() != '('){
+                _out += ' ';
+            }
+            cell = top.advance();
+        }
+    }
+
+    std::optional<Cell> readSexpr(const std::string &_text)
+    {
+        auto reader = FormReader::fromText(_text);
+        auto value = reader->next();
+        if(!value){
+            if(reader->good()){
+                std::cerr << "read-sexpr: no value" << std::endl;
+            }
+            return std::nullopt;
+        }
+
+        if(reader->next() || !reader->good()){
+            std::cerr << "read-sexpr: more than one value" << std::endl;
+            return std::nullopt;
+        }
+
+        return value;
+    }
+
+    // JSON
+
+    static void writeJsonString(const std::string &_s, std::string &_out)
+    {
+        static const char hex[] = "0123456789abcdef";
+
+        _out += '"';
+        for(char c : _s){
+            switch(c){
+                case '"': _out += "\\\""; break;
+                case '\\': _out += "\\\\"; break;
+                case '\n': _out += "\\n"; break;
+                case '\t': _out += "\\t"; break;
+                case '\r': _out += "\\r"; break;
+                case '\b': _out += "\\b"; break;
+                case '\f': _out += "\\f"; break;
+                default:
+                    if(static_cast<unsigned char>(c) < 0x20){
+                        _out += "\\u00";
+                        _out += hex[c >> 4];
+                        _out += hex[c & 15];
+                    }
+                    else{
+                        _out += c;
+                    }
+            }
+        }
+        _out += '"';
+    }
+
+    // keys are written as strings
+    static bool writeJsonKey(const Cell &_key, std::string &_out)
+    {
+        if(_key.isType<Quotation>()){
+            writeJsonString(_key.ref<Quotation>().str(), _out);
+        }
+        else if(_key.isType<String>()){
+            writeJsonString(_key.ref<String>().str(), _out);
+        }
+        else if(_key.isType<std::string>()){
+            writeJsonString(_key.ref<std::string>(), _out);
+        }
+        else{
+            std::cerr << "to-json: object key is not a symbol or string" << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    static bool writeJsonAtom(const Cell &_cell, std::string &_out)
+    {
+        if(_cell.isType<bool>()){
+            _out += _cell.get<bool>() ? "true" : "false";
+        }
+        else if(_cell.isType<Int>()){
+            writeInt(_cell.get<Int>(), _out);
+        }
+        else if(_cell.isType<BigInt>()){
+            _out += _cell.ref<BigInt>().toString();
+        }
+        else if(_cell.isType<double>()){
+            return writeFloat(_cell.get<double>(), _out);
+        }
+        else if(_cell.isType<String>()){
+            writeJsonString(_cell.ref<String>().str(), _out);
+        }
+        else if(_cell.isType<Quotation>()){
+            auto s = _cell.ref<Quotation>().str();
+            if(s == "null"){
+                _out += "null";
+            }
+            else{
+                writeJsonString(s, _out);
+            }
+        }
+        else if(_cell.isType<std::string>()){
+            writeJsonString(_cell.ref<std::string>(), _out);
+        }
+        else{
+            std::cerr << "to-json: value has no text" << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    bool writeJson(const Cell &_cell, std::string &_out)
+    {
+        // an array or object being written, objects hold their entries in map order
+        struct Open{
+            Frame array;
+            std::vector<std::pair<const Cell *, const Cell *>> entries;
+            std::size_t next = 0;
+            bool object;
+        };
+        std::vector<Open> stack;
+        const Cell *cell = &_cell;
+
+        while(true){
+            if(cell){
+                if(cell->isType<List>()){
+                    auto &list = cell->ref<List>();
+                    _out += '[';
+                    stack.push_back({{list.begin(), list.end()}, {}, 0, false});
+                }
+                else if(cell->isType<Vector>()){
+                    _out += '[';
+                    stack.push_back({{List::const_iterator(), List::const_iterator(), &cell->ref<Vector>()}, {}, 0, false});
+                }
+                else if(cell->isType<Map>()){
+                    _out += '{';
+                    stack.push_back({{}, {}, 0, true});
+                    auto &entries = stack.back().entries;
+                    cell->ref<Map>().forEach([&](const Cell &_key, const Cell &_value)
+                        {
+                            entries.push_back({&_key, &_value});
+                        }
+                    );
+                }
+                else if(!writeJsonAtom(*cell, _out)){
+                    return false;
+                }
+            }
+
+            if(stack.empty()){
+                return true;
+            }
+
+            auto &top = stack.back();
+            if(top.object ? top.next == top.entries.size() : top.array.done()){
+                _out += top.object ? '}' : ']';
+                stack.pop_back();
+                cell = nullptr;
+                continue;
+            }
+
+            if(_out.back() != '{' && _out.back() != '['){
+                _out += ',';
+            }
+
+            if(top.object){
+                auto &entry = top.entries[top.next++];
+                if(!writeJsonKey(*entry.first, _out)){
+                    return false;
+                }
+                _out += ':';
+                cell = entry.second;
+            }
+            else{
+                cell = top.array.advance();
+            }
+        }
+    }
+
+    // a JSON text being read, failures report the byte offset
+    class JsonInput{
+        private:
+            const std::string &text;
+            std::size_t pos = 0;
+
+            static void appendUtf8(unsigned _code, std::string &_out)
+            {
+                if(_code < 0x80){
+                    _out += char(_code);
+                }
+                else if(_code < 0x800){
+                    _out += char(0xc0 | (_code >> 6));
+                    _out += char(0x80 | (_code & 0x3f));
+                }
+                else if(_code < 0x10000){
+                    _out += char(0xe0 | (_code >> 12));
+                    _out += char(0x80 | ((_code >> 6) & 0x3f));
+                    _out += char(0x80 | (_code & 0x3f));
+                }
+                else{
+                    _out += char(0xf0 | (_code >> 18));
+                    _out += char(0x80 | ((_code >> 12) & 0x3f));
+                    _out += char(0x80 | ((_code >> 6) & 0x3f));
+                    _out += char(0x80 | (_code & 0x3f));
+                }
+            }
+
+            bool hex4(unsigned &_code)
+            {
+                if(text.size() - pos < 4){
+                    return false;
+                }
+
+                _code = 0;
+                for(int i = 0; i < 4; i++){
+                    char c = text[pos++];
+                    _code <<= 4;
+                    if(c >= '0' && c <= '9') _code |= c - '0';
+                    else if(c >= 'a' && c <= 'f') _code |= c - 'a' + 10;
+                    else if(c >= 'A' && c <= 'F') _code |= c - 'A' + 10;
+                    else return false;
+                }
+                return true;
+            }
+
+        public:
+            explicit JsonInput(const std::string &_text) : text(_text) {}
+
+            bool fail(const char *_what)
+            {
+                std::cerr << "from-json: " << _what << " at " << pos << std::endl;
+                return false;
+            }
+
+            // the next character that is not whitespace, 0 at the end
+            char peek()
+            {
+                while(pos < text.size() && isspace(static_cast<unsigned char>(text[pos]))){
+                    pos++;
+                }
+                return pos < text.size() ? text[pos] : '\0';
+            }
+
+            bool expect(char _c)
+            {
+                if(peek() != _c){
+                    return false;
+                }
+                pos++;
+                return true;
+            }
+
+            bool string(std::string &_out)
+            {
+                if(!expect('"')){
+                    return fail("need a string");
+                }
+
+                while(pos < text.size()){
+                    char c = text[pos++];
+
+                    if(c == '"'){
+                        return true;
+                    }
+
+                    if(c != '\\'){
+                        _out += c;
+                        continue;
+                    }
+
+                    if(pos == text.size()){
+                        break;
+                    }
+
+                    c = text[pos++];
+                    switch(c){
+                        case 'b': _out += '\b'; break;
+                        case 'f': _out += '\f'; break;
+                        case 'n': _out += '\n'; break;
+                        case 'r': _out += '\r'; break;
+                        case 't': _out += '\t'; break;
+                        case 'u':{
+                            unsigned code;
+                            if(!hex4(code)){
+                                return fail("invalid escape");
+                            }
+
+                            // a surrogate pair is one code point
+                            unsigned low;
+                            if(code >= 0xd800 && code < 0xdc00 && text.compare(pos, 2, "\\u") == 0){
+                                pos += 2;
+                                if(!hex4(low) || low < 0xdc00 || low >= 0xe000){
+                                    return fail("invalid surrogate pair");
+                                }
+                                code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                            }
+
+                            appendUtf8(code, _out);
+                            break;
+                        }
+                        default: _out += c;
+                    }
+                }
+
+                return fail("unterminated string");
+            }
+
+            std::optional<Cell> atom()
+            {
+                auto c = peek();
+
+                if(c == '"'){
+                    std::string s;
+                    if(!string(s)){
+                        return std::nullopt;
+                    }
+                    return String(std::move(s));
+                }
+
+                auto first = pos;
+                while(pos < text.size() && (isalnum(static_cast<unsigned char>(text[pos])) || text[pos] == '-'
+                    || text[pos] == '+' || text[pos] == '.')){
+                    pos++;
+                }
+
+                auto token = text.substr(first, pos - first);
+                if(token == "true" || token == "false"){
+                    return token == "true";
+                }
+
+                if(token == "null"){
+                    return Quotation("null");
+                }
+
+                auto number = parseNumber(token);
+                if(!number){
+                    pos = first;
+                    fail("invalid value");
+                }
+
+                return number;
+            }
+
+            bool done()
+            {
+                return peek() == '\0';
+            }
+    };
+
+    std::optional<Cell> readJson(const std::string &_text)
+    {
+        JsonInput in(_text);
+
+        struct Open{
+            List list;
+            std::optional<MapBuilder> map;
+            std::optional<Quotation> key;
+        };
+        std::vector<Open> stack;
+
+        // reads the key of the next entry of the innermost object
+        auto key = [&]() -> bool
+            {
+                std::string name;
+                if(!in.string(name)){
+                    return false;
+                }
+
+                stack.back().key = Quotation(name);
+                return in.expect(':') || in.fail("need :");
+            };
+
+        while(true){
+            // a value
+            std::optional<Cell> value;
+            auto c = in.peek();
+
+            if(c == '[' || c == '{'){
+                in.expect(c);
+                stack.push_back({List(), std::nullopt, std::nullopt});
+                if(c == '{'){
+                    stack.back().map.emplace();
+                }
+
+                if(!in.expect(c == '[' ? ']' : '}')){
+                    if(c == '{' && !key()){
+                        return std::nullopt;
+                    }
+                    continue;
+                }
+
+                if(c == '{'){
+                    value = stack.back().map->build();
+                }
+                else{
+                    value = std::move(stack.back().list);
+                }
+                stack.pop_back();
+            }
+            else{
+                value = in.atom();
+                if(!value){
+                    return std::nullopt;
+                }
+            }
+
+            // then the containers it completes
+            while(true){
+                if(stack.empty()){
+                    if(!in.done()){
+                        in.fail("more than one value");
+                        return std::nullopt;
+                    }
+                    return value;
+                }
+
+                auto &top = stack.back();
+                bool object = top.map.has_value();
+                if(object){
+                    top.map->set(top.key.value(), std::move(value.value()));
+                }
+                else{
+                    top.list.push_back(std::move(value.value()));
+                }
+
+                if(in.expect(',')){
+                    if(object && !key()){
+                        return std::nullopt;
+                    }
+                    break;
+                }
+
+                if(!in.expect(object ? '}' : ']')){
+                    in.fail(object ? "need , or }" : "need , or ]");
+                    return std::nullopt;
+                }
+
+                if(object){
+                    value = top.map->build();
+                }
+                else{
+                    value = std::move(top.list);
+                }
+                stack.pop_back();
+            }
+        }
+    }
+
+    static const String *textOf(Args _args, const char *_name)
+    {
+        if(_args.size() != 1 || !_args.front().isType<String>()){
+            std::cerr << _name << ": need a string" << std::endl;
+            return nullptr;
+        }
+
+        return &_args.front().ref<String>();
+    }
+
+    std::optional<Cell> buildinWriteSexpr(Args _args, PtrEnvir &)
+    {
+        if(_args.size() != 1){
+            std::cerr << "write-sexpr: need 1 arg" << std::endl;
+            return std::nullopt;
+        }
+
+        std::string out;
+        if(!writeSexpr(_args.front(), out)){
+            return std::nullopt;
+        }
+
+        return String(std::move(out));
+    }
+
+    std::optional<Cell> buildinReadSexpr(Args _args, PtrEnvir &)
+    {
+        auto text = textOf(_args, "read-sexpr");
+        return text ? readSexpr(text->str()) : std::nullopt;
+    }
+
+    std::optional<Cell> buildinToJson(Args _args, PtrEnvir &)
+    {
+        if(_args.size() != 1){
+            std::cerr << "to-json: need 1 arg" << std::endl;
+            return std::nullopt;
+        }
+
+        std::string out;
+        if(!writeJson(_args.front(), out)){
+            return std::nullopt;
+        }
+
+        return String(std::move(out));
+    }
+
+    std::optional<Cell> buildinFromJson(Args _args, PtrEnvir &)
+    {
+        auto text = textOf(_args, "from-json");
+        return text ? readJson(text->str()) : std::nullopt;
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include "lispbase.h"
+
+namespace lisp
+{
+    // Writers append to _out without recursion and fail on values that have no text,
+    // such as procedures. Readers take one value and fail on anything after it.
+
+    // S-expressions as the data reader reads them, symbols stay bare and strings are quoted.
+    // A vector is written as (vector <value> ...), which reads back as that list and evaluates
+    // to the vector again.
+    bool writeSexpr(const Cell &_cell, std::string &_out);
+    std::optional<Cell> readSexpr(const std::string &_text);
+
+    // JSON objects are maps with symbol keys, arrays are lists, the symbol null is null
+    // and other symbols are written as strings. Vectors are written as arrays and read back as lists.
+    bool writeJson(const Cell &_cell, std::string &_out);
+    std::optional<Cell> readJson(const std::string &_text);
+}
@@ -0,0 +1,361 @@
+#ifndef _WIN32
+#include "lisp.h"
+#include "serial.h"
+#include "shard.h"
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <deque>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace lisp
+{
+    // frames on the pipes are a 4 byte length and then the text
+
+    static bool writeAll(int _fd, const char *_data, std::size_t _size)
+    {
+        while(_size > 0){
+            auto n = write(_fd, _data, _size);
+            if(n < 0 && errno == EINTR){
+                continue;
+            }
+            if(n <= 0){
+                return false;
+            }
+
+            _data += n;
+            _size -= n;
+        }
+
+        return true;
+    }
+
+    static bool readAll(int _fd, char *_data, std::size_t _size)
+    {
+        while(_size > 0){
+            auto n = read(_fd, _data, _size);
+            if(n < 0 && errno == EINTR){
+                continue;
+            }
+            if(n <= 0){
+                return false;
+            }
+
+            _data += n;
+            _size -= n;
+        }
+
+        return true;
+    }
+
+    static bool sendFrame(int _fd, const std::string &_text)
+    {
+        std::uint32_t size = _text.size();
+        return writeAll(_fd, reinterpret_cast<const char *>(&size), sizeof(size))
+            && writeAll(_fd, _text.data(), _text.size());
+    }
+
+    static bool recvFrame(int _fd, std::string &_text)
+    {
+        std::uint32_t size;
+        if(!readAll(_fd, reinterpret_cast<char *>(&size), sizeof(size))){
+            return false;
+        }
+
+        _text.resize(size);
+        return readAll(_fd, _text.data(), size);
+    }
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Worker{
+        pid_t pid = -1;
+        int in = -1, out = -1;  // ends the parent writes inputs to and reads results from
+        long item = -1;         // input in flight, -1 when idle
+        Clock::time_point deadline;
+    };
+
+    // replies start with v and the result, or e when _f failed
+    static void serveInputs(int _in, int _out, const Cell &_f, PtrEnvir &_envir)
+    {
+        std::string text;
+        while(recvFrame(_in, text)){
+            std::string reply = "v";
+
+            auto input = readSexpr(text);
+            std::optional<Cell> result;
+            if(input){
+                std::vector<Cell> values{std::move(input.value())};
+                result = applyValues(_f, values, _envir);
+            }
+
+            if(!(result && writeSexpr(result.value(), reply))){
+                reply = "e";
+            }
+
+            if(!sendFrame(_out, reply)){
+                return;
+            }
+        }
+    }
+
+    static bool startWorker(Worker &_worker, const std::vector<Worker> &_workers, const Cell &_f, PtrEnvir &_envir)
+    {
+        int down[2], up[2];
+        if(pipe(down) != 0){
+            return false;
+        }
+        if(pipe(up) != 0){
+            close(down[0]);
+            close(down[1]);
+            return false;
+        }
+
+        auto pid = fork();
+        if(pid < 0){
+            for(int fd : {down[0], down[1], up[0], up[1]}){
+                close(fd);
+            }
+            return false;
+        }
+
+        if(pid == 0){
+            // pipes of the other workers would keep them from seeing the end of their input
+            for(auto &worker : _workers){
+                if(worker.pid > 0){
+                    close(worker.in);
+                    close(worker.out);
+                }
+            }
+            close(down[1]);
+            close(up[0]);
+
+            serveInputs(down[0], up[1], _f, _envir);
+            _exit(0);
+        }
+
+        close(down[0]);
+        close(up[1]);
+        _worker.pid = pid;
+        _worker.in = down[1];
+        _worker.out = up[0];
+        _worker.item = -1;
+        return true;
+    }
+
+    static void stopWorker(Worker &_worker, bool _kill)
+    {
+        if(_worker.pid <= 0){
+            return;
+        }
+
+        close(_worker.in);
+        close(_worker.out);
+        if(_kill){
+            kill(_worker.pid, SIGKILL);
+        }
+        waitpid(_worker.pid, nullptr, 0);
+
+        _worker = Worker();
+    }
+
+    std::optional<List> shardMap(const Cell &_f, const List &_inputs, const ShardOptions &_options, PtrEnvir &_envir)
+    {
+        std::vector<std::string> texts;
+        for(auto &input : _inputs){
+            texts.emplace_back();
+            if(!writeSexpr(input, texts.back())){
+                std::cerr << "shard-map: inputs must be data" << std::endl;
+                return std::nullopt;
+            }
+        }
+
+        auto count = texts.size();
+        std::vector<std::optional<Cell>> results(count);
+        std::vector<int> attempts(count, 0);
+        std::deque<long> pending;
+        for(std::size_t i = 0; i < count; i++){
+            pending.push_back(i);
+        }
+
+        long workers = _options.workers > 0 ? _options.workers : sysconf(_SC_NPROCESSORS_ONLN);
+        workers = std::max(1L, std::min(workers, long(count)));
+
+        // a worker gone while we write to it is noticed by its pipe, not by a signal
+        auto pipeHandler = std::signal(SIGPIPE, SIG_IGN);
+        std::cout.flush();
+
+        std::vector<Worker> pool(count ? workers : 0);
+        bool ok = true;
+
+        for(auto &worker : pool){
+            if(!startWorker(worker, pool, _f, _envir)){
+                std::cerr << "shard-map: cannot start a worker" << std::endl;
+                ok = false;
+                break;
+            }
+        }
+
+        // the input of a dead or hung worker goes back to the front of the queue
+        auto lost = [&](Worker &_worker, const char *_what) -> bool
+            {
+                auto item = _worker.item;
+                stopWorker(_worker, true);
+
+                if(attempts[item] >= _options.attempts){
+                    std::cerr << "shard-map: input " << item << " lost " << attempts[item] << " workers" << std::endl;
+                    return false;
+                }
+
+                std::cerr << "shard-map: worker " << _what << ", resubmitting input " << item << std::endl;
+                pending.push_front(item);
+
+                if(!startWorker(_worker, pool, _f, _envir)){
+                    std::cerr << "shard-map: cannot start a worker" << std::endl;
+                    return false;
+                }
+                return true;
+            };
+
+        std::size_t remaining = count;
+        std::string reply;
+
+        while(ok && remaining > 0){
+            // one input in flight per worker, so neither side can block the other on a full pipe
+            for(auto &worker : pool){
+                if(ok && worker.item < 0 && !pending.empty()){
+                    worker.item = pending.front();
+                    pending.pop_front();
+                    attempts[worker.item]++;
+                    worker.deadline = Clock::now() + std::chrono::milliseconds(_options.timeout);
+
+                    if(!sendFrame(worker.in, texts[worker.item])){
+                        ok = lost(worker, "died");
+                    }
+                }
+            }
+
+            std::vector<pollfd> fds;
+            std::vector<Worker *> busy;
+            auto deadline = Clock::time_point::max();
+            for(auto &worker : pool){
+                if(worker.item >= 0){
+                    fds.push_back({worker.out, POLLIN, 0});
+                    busy.push_back(&worker);
+                    deadline = std::min(deadline, worker.deadline);
+                }
+            }
+
+            if(!ok || fds.empty()){
+                continue;
+            }
+
+            // wait no longer than the first deadline, rounded up so that it has passed on return
+            auto wait = std::chrono::ceil<std::chrono::milliseconds>(deadline - Clock::now()).count();
+            if(poll(fds.data(), fds.size(), std::max<long long>(wait, 0)) < 0){
+                if(errno == EINTR){
+                    continue;
+                }
+                ok = false;
+                break;
+            }
+
+            auto now = Clock::now();
+            for(std::size_t i = 0; ok && i < fds.size(); i++){
+                auto &worker = *busy[i];
+
+                if(!fds[i].revents){
+                    if(now >= worker.deadline){
+                        ok = lost(worker, "timed out");
+                    }
+                    continue;
+                }
+
+                if(!recvFrame(worker.out, reply)){
+                    ok = lost(worker, "died");
+                    continue;
+                }
+
+                auto result = reply[0] == 'v' ? readSexpr(reply.substr(1)) : std::nullopt;
+                if(!result){
+                    std::cerr << "shard-map: failed on input " << worker.item << std::endl;
+                    ok = false;
+                    break;
+                }
+
+                results[worker.item] = std::move(result);
+                worker.item = -1;
+                remaining--;
+            }
+        }
+
+        // closing their input lets finished workers exit on their own
+        for(auto &worker : pool){
+            stopWorker(worker, !ok);
+        }
+        std::signal(SIGPIPE, pipeHandler);
+
+        if(!ok){
+            return std::nullopt;
+        }
+
+        List list;
+        for(auto &result : results){
+            list.push_back(std::move(result.value()));
+        }
+        return list;
+    }
+
+    // (shard-map <f> <inputs> [:workers <n>] [:attempts <n>] [:timeout <ms>])
+    std::optional<Cell> buildinShardMap(Args _args, PtrEnvir &_envir)
+    {
+        if(_args.size() < 2 || _args.size() % 2 != 0){
+            std::cerr << "shard-map: need a procedure, a list and keyword options" << std::endl;
+            return std::nullopt;
+        }
+
+        auto it = _args.begin();
+        auto &f = *it++;
+        auto &inputs = *it++;
+        if(!inputs.isType<List>()){
+            std::cerr << "shard-map: need a list of inputs" << std::endl;
+            return std::nullopt;
+        }
+
+        ShardOptions options;
+        for(; it != _args.end(); it++){
+            auto &key = *it++;
+            auto &value = *it;
+
+            if(!(key.isType<Quotation>() && value.isType<Int>() && value.get<Int>() > 0)){
+                std::cerr << "shard-map: options are a keyword and a positive int" << std::endl;
+                return std::nullopt;
+            }
+
+            if(key.ref<Quotation>().str() == ":workers"){
+                options.workers = value.get<Int>();
+            }
+            else if(key.ref<Quotation>().str() == ":attempts"){
+                options.attempts = value.get<Int>();
+            }
+            else if(key.ref<Quotation>().str() == ":timeout"){
+                options.timeout = value.get<Int>();
+            }
+            else{
+                std::cerr << "shard-map: unknown option " << key.ref<Quotation>().str() << std::endl;
+                return std::nullopt;
+            }
+        }
+
+        auto results = shardMap(f, inputs.ref<List>(), options, _envir);
+        if(!results){
+            return std::nullopt;
+        }
+
+        return std::move(results.value());
+    }
+}
+#endif
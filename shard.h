@@ -0,0 +1,20 @@
+#pragma once
+#include "lispbase.h"
+
+#ifndef _WIN32
+namespace lisp
+{
+    struct ShardOptions{
+        int workers = 0;  // 0 means one per online CPU
+        int attempts = 3; // tries per input before a worker crash or hang fails the whole map
+        int timeout = 60000; // milliseconds an input may take before its worker counts as hung
+    };
+
+    // Applies _f to every input in forked worker processes, which inherit everything
+    // defined so far. Inputs and results cross pipes as S-expressions, so both must be
+    // data. A worker that dies or hangs past the timeout is killed and replaced, and its
+    // input handed out again.
+    // Results are in input order, std::nullopt if _f failed or an input ran out of attempts.
+    std::optional<List> shardMap(const Cell &_f, const List &_inputs, const ShardOptions &_options, PtrEnvir &_envir);
+}
+#endif
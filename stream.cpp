@@ -0,0 +1,355 @@
+#include "lisp.h"
+
+namespace lisp
+{
+    // Forced streams are chains of promises, each memoizing the next stream pair.
+    // The tail is unlinked one promise at a time, so dropping a long chain does not recurse.
+    static PtrPromise detachTail(std::optional<Cell> &_value)
+    {
+        if(!(_value && _value.value().isType<List>())){
+            return nullptr;
+        }
+
+        auto &list = _value.value().ref<List>();
+        if(list.empty() || !list.back().isType<PtrPromise>()){
+            return nullptr;
+        }
+
+        auto tail = std::move(list.back().ref<PtrPromise>());
+        return tail.use_count() == 1 ? tail : nullptr;
+    }
+
+    Promise::~Promise()
+    {
+        auto next = detachTail(value);
+
+        while(next){
+            auto after = detachTail(next->value);
+            next = std::move(after);
+        }
+    }
+
+    std::optional<Cell> Promise::force()
+    {
+        if(value){
+            return value;
+        }
+
+        if(!thunk){
+            std::cerr << "force: promise forced while being forced" << std::endl;
+            return std::nullopt;
+        }
+
+        // dropped once it succeeded, so the frames it captured are released
+        auto f = std::move(thunk);
+        thunk = nullptr;
+
+        auto result = f();
+        if(!result){
+            thunk = std::move(f);
+            return std::nullopt;
+        }
+
+        if(!value){
+            value = std::move(result);
+        }
+
+        return value;
+    }
+
+    // a stream is the empty list or a list of its first element and a promise of the rest
+    static bool isStream(const Cell &_cell, const char *_name)
+    {
+        if(_cell.isType<List>()){
+            auto &list = _cell.ref<List>();
+            if(list.empty() || (list.size() == 2 && list.back().isType<PtrPromise>())){
+                return true;
+            }
+        }
+
+        std::cerr << _name << ": need a stream" << std::endl;
+        return false;
+    }
+
+    static Cell makeStream(const Cell &_first, std::function<std::optional<Cell> ()> _rest)
+    {
+        return List{_first, std::make_shared<Promise>(std::move(_rest))};
+    }
+
+    // the rest of a stream pair
+    static std::optional<Cell> forceRest(const Cell &_promise, const char *_name)
+    {
+        auto rest = _promise.ref<PtrPromise>()->force();
+        if(!(rest && isStream(rest.value(), _name))){
+            return std::nullopt;
+        }
+
+        return rest;
+    }
+
+    // (delay <expr>)
+    std::optional<Cell> buildinDelay(Args _args, PtrEnvir &_envir)
+    {
+        if(_args.size() != 1){
+            std::cerr << "delay: need 1 arg" << std::endl;
+            return std::nullopt;
+        }
+
+        return std::make_shared<Promise>(
+            [expr = _args.front(), envir = _envir]() mutable
+            {
+                return evaluate(expr, envir);
+            }
+        );
+    }
+
+    // (stream-cons <first> <rest>) => (list <first> (delay <rest>))
+    std::optional<Cell> buildinStreamCons(Args _args, PtrEnvir &_envir)
+    {
+        if(_args.size() != 2){
+            std::cerr << "stream-cons: need 2 args" << std::endl;
+            return std::nullopt;
+        }
+
+        auto first = evaluate(_args.front(), _envir);
+        if(!first){
+            std::cerr << "stream-cons: invalid first" << std::endl;
+            return std::nullopt;
+        }
+
+        auto rest = buildinDelay(_args.tail(), _envir);
+        return List{first.value(), rest.value()};
+    }
+
+    // (stream-fold <f> <init> <stream>) => (f xn ... (f x2 (f x1 init)))
+    // evaluates its own operands, so the consumed part of the stream is released as it goes
+    std::optional<Cell> buildinStreamFold(Args _args, PtrEnvir &_envir)
+    {
+        if(_args.size() != 3){
+            std::cerr << "stream-fold: need 3 args" << std::endl;
+            return std::nullopt;
+        }
+
+        auto it = _args.begin();
+        auto f = evaluate(*it++, _envir);
+        auto acc = evaluate(*it++, _envir);
+        auto stream = evaluate(*it, _envir);
+        if(!(f && acc && stream && isStream(stream.value(), "stream-fold"))){
+            return std::nullopt;
+        }
+
+        while(!stream.value().ref<List>().empty()){
+            auto &list = stream.value().ref<List>();
+
+            acc = applyTwo(f.value(), list.front(), acc.value(), _envir);
+            if(!acc){
+                return std::nullopt;
+            }
+
+            stream = forceRest(list.back(), "stream-fold");
+            if(!stream){
+                return std::nullopt;
+            }
+        }
+
+        return acc;
+    }
+
+    // (make-promise <value>) is an already forced promise
+    std::optional<Cell> buildinMakePromise(Args _args, PtrEnvir &)
+    {
+        if(_args.size() != 1){
+            std::cerr << "make-promise: need 1 arg" << std::endl;
+            return std::nullopt;
+        }
+
+        if(_args.front().isType<PtrPromise>()){
+            return _args.front();
+        }
+
+        return std::make_shared<Promise>(_args.front());
+    }
+
+    // (force <promise>), anything else is its own value
+    std::optional<Cell> buildinForce(Args _args, PtrEnvir &)
+    {
+        if(_args.size() != 1){
+            std::cerr << "force: need 1 arg" << std::endl;
+            return std::nullopt;
+        }
+
+        if(!_args.front().isType<PtrPromise>()){
+            return _args.front();
+        }
+
+        return _args.front().ref<PtrPromise>()->force();
+    }
+
+    std::optional<Cell> buildinStreamCar(Args _args, PtrEnvir &)
+    {
+        if(_args.size() != 1 || !isStream(_args.front(), "stream-car")){
+            return std::nullopt;
+        }
+
+        auto &list = _args.front().ref<List>();
+        if(list.empty()){
+            std::cerr << "stream-car: empty stream" << std::endl;
+            return std::nullopt;
+        }
+
+        return list.front();
+    }
+
+    std::optional<Cell> buildinStreamCdr(Args _args, PtrEnvir &)
+    {
+        if(_args.size() != 1 || !isStream(_args.front(), "stream-cdr")){
+            return std::nullopt;
+        }
+
+        auto &list = _args.front().ref<List>();
+        if(list.empty()){
+            std::cerr << "stream-cdr: empty stream" << std::endl;
+            return std::nullopt;
+        }
+
+        return forceRest(list.back(), "stream-cdr");
+    }
+
+    std::optional<Cell> buildinStreamNull(Args _args, PtrEnvir &)
+    {
+        if(_args.size() != 1 || !isStream(_args.front(), "stream-null?")){
+            return std::nullopt;
+        }
+
+        return _args.front().ref<List>().empty();
+    }
+
+    static std::optional<Cell> streamMap(const Cell &_f, const Cell &_stream, PtrEnvir _envir)
+    {
+        auto &list = _stream.ref<List>();
+        if(list.empty()){
+            return List();
+        }
+
+        auto first = applyOne(_f, list.front(), _envir);
+        if(!first){
+            return std::nullopt;
+        }
+
+        return makeStream(first.value(),
+            [f = _f, rest = list.back(), envir = _envir]() -> std::optional<Cell>
+            {
+                auto next = forceRest(rest, "stream-map");
+                return next ? streamMap(f, next.value(), envir) : std::nullopt;
+            }
+        );
+    }
+
+    // (stream-map <f> <stream>)
+    std::optional<Cell> buildinStreamMap(Args _args, PtrEnvir &_envir)
+    {
+        if(_args.size() != 2 || !isStream(_args.back(), "stream-map")){
+            return std::nullopt;
+        }
+
+        return streamMap(_args.front(), _args.back(), _envir);
+    }
+
+    static std::optional<Cell> streamFilter(const Cell &_pred, Cell _stream, PtrEnvir _envir)
+    {
+        // skipped elements are released as the loop moves on
+        while(!_stream.ref<List>().empty()){
+            auto &list = _stream.ref<List>();
+
+            auto keep = applyOne(_pred, list.front(), _envir);
+            if(!(keep && keep.value().isType<bool>())){
+                std::cerr << "stream-filter: invalid condition" << std::endl;
+                return std::nullopt;
+            }
+
+            if(keep.value().get<bool>()){
+                return makeStream(list.front(),
+                    [pred = _pred, rest = list.back(), envir = _envir]() -> std::optional<Cell>
+                    {
+                        auto next = forceRest(rest, "stream-filter");
+                        return next ? streamFilter(pred, next.value(), envir) : std::nullopt;
+                    }
+                );
+            }
+
+            auto next = forceRest(list.back(), "stream-filter");
+            if(!next){
+                return std::nullopt;
+            }
+
+            _stream = std::move(next.value());
+        }
+
+        return _stream;
+    }
+
+    // (stream-filter <pred> <stream>)
+    std::optional<Cell> buildinStreamFilter(Args _args, PtrEnvir &_envir)
+    {
+        if(_args.size() != 2 || !isStream(_args.back(), "stream-filter")){
+            return std::nullopt;
+        }
+
+        return streamFilter(_args.front(), _args.back(), _envir);
+    }
+
+    static Cell streamTake(Int _n, const Cell &_stream)
+    {
+        auto &list = _stream.ref<List>();
+        if(_n <= 0 || list.empty()){
+            return List();
+        }
+
+        // the source is not forced past the last element taken
+        return makeStream(list.front(),
+            [n = _n - 1, rest = list.back()]() -> std::optional<Cell>
+            {
+                if(n == 0){
+                    return List();
+                }
+
+                auto next = forceRest(rest, "stream-take");
+                return next ? std::optional<Cell>(streamTake(n, next.value())) : std::nullopt;
+            }
+        );
+    }
+
+    // (stream-take <n> <stream>)
+    std::optional<Cell> buildinStreamTake(Args _args, PtrEnvir &)
+    {
+        if(_args.size() != 2 || !_args.front().isType<Int>() || !isStream(_args.back(), "stream-take")){
+            std::cerr << "stream-take: need a count and a stream" << std::endl;
+            return std::nullopt;
+        }
+
+        return streamTake(_args.front().get<Int>(), _args.back());
+    }
+
+    // (stream->list <stream>)
+    std::optional<Cell> buildinStreamToList(Args _args, PtrEnvir &)
+    {
+        if(_args.size() != 1 || !isStream(_args.front(), "stream->list")){
+            return std::nullopt;
+        }
+
+        List result;
+        std::optional<Cell> stream = _args.front();
+
+        while(!stream.value().ref<List>().empty()){
+            auto &list = stream.value().ref<List>();
+            result.push_back(list.front());
+
+            stream = forceRest(list.back(), "stream->list");
+            if(!stream){
+                return std::nullopt;
+            }
+        }
+
+        return result;
+    }
+}
@@ -0,0 +1,137 @@
+#include "lisp.h"
+#include <charconv>
+#include <cmath>
+
+namespace lisp
+{
+    static const String *stringOf(const Cell &_cell, const char *_name)
+    {
+        if(!_cell.isType<String>()){
+            std::cerr << _name << ": need a string" << std::endl;
+            return nullptr;
+        }
+
+        return &_cell.ref<String>();
+    }
+
+    // (string-append <string1> ... <stringn>)
+    std::optional<Cell> buildinStringAppend(Args _args, PtrEnvir &)
+    {
+        std::size_t size = 0;
+        for(auto &arg : _args){
+            auto s = stringOf(arg, "string-append");
+            if(!s){
+                return std::nullopt;
+            }
+            size += s->str().size();
+        }
+
+        std::string result;
+        result.reserve(size);
+        for(auto &arg : _args){
+            result += arg.ref<String>().str();
+        }
+
+        return String(std::move(result));
+    }
+
+    // (substring <string> <start> [<end>]), end defaults to the length
+    std::optional<Cell> buildinSubstring(Args _args, PtrEnvir &)
+    {
+        if(_args.size() != 2 && _args.size() != 3){
+            std::cerr << "substring: need 2 or 3 args" << std::endl;
+            return std::nullopt;
+        }
+
+        auto s = stringOf(_args.front(), "substring");
+        if(!s){
+            return std::nullopt;
+        }
+
+        auto &text = s->str();
+        auto &first = *std::next(_args.begin());
+        auto &last = _args.back();
+
+        if(!(first.isType<Int>() && (_args.size() == 2 || last.isType<Int>()))){
+            std::cerr << "substring: need integer indexes" << std::endl;
+            return std::nullopt;
+        }
+
+        auto begin = first.get<Int>();
+        auto end = _args.size() == 3 ? last.get<Int>() : Int(text.size());
+        if(begin < 0 || end < begin || std::size_t(end) > text.size()){
+            std::cerr << "substring: index out of range" << std::endl;
+            return std::nullopt;
+        }
+
+        return String(text.substr(begin, end - begin));
+    }
+
+    std::optional<Cell> buildinStringLength(Args _args, PtrEnvir &)
+    {
+        if(_args.size() != 1){
+            std::cerr << "string-length: need 1 arg" << std::endl;
+            return std::nullopt;
+        }
+
+        auto s = stringOf(_args.front(), "string-length");
+        if(!s){
+            return std::nullopt;
+        }
+
+        return Int(s->str().size());
+    }
+
+    // (string->number <string>), false if it is not a number
+    std::optional<Cell> buildinStringToNumber(Args _args, PtrEnvir &)
+    {
+        if(_args.size() != 1){
+            std::cerr << "string->number: need 1 arg" << std::endl;
+            return std::nullopt;
+        }
+
+        auto s = stringOf(_args.front(), "string->number");
+        if(!s){
+            return std::nullopt;
+        }
+
+        auto number = parseNumber(s->str());
+        if(!number){
+            return false;
+        }
+
+        return number;
+    }
+
+    std::optional<Cell> buildinNumberToString(Args _args, PtrEnvir &)
+    {
+        if(_args.size() != 1){
+            std::cerr << "number->string: need 1 arg" << std::endl;
+            return std::nullopt;
+        }
+
+        auto &number = _args.front();
+        if(number.isType<Int>()){
+            return String(std::to_string(number.get<Int>()));
+        }
+
+        if(number.isType<BigInt>()){
+            return String(number.ref<BigInt>().toString());
+        }
+
+        // the shortest text that reads back as the same double, and as a double, not an Int
+        if(number.isType<double>()){
+            auto value = number.get<double>();
+            char text[32];
+            auto end = std::to_chars(text, text + sizeof(text), value).ptr;
+            std::string str(text, end);
+            if(std::isfinite(value) && str.find_first_of(".e") == std::string::npos){
+                str += ".0";
+            }
+            return String(std::move(str));
+        }
+
+        std::cerr << "number->string: need a number" << std::endl;
+        return std::nullopt;
+    }
+}